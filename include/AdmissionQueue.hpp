@@ -0,0 +1,412 @@
+/**
+ * @file AdmissionQueue.hpp
+ * @brief Contains implementation of the overload protection stage between server and formatter.
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef ADMISSIONQUEUE_HPP_
+#define ADMISSIONQUEUE_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string_view>
+
+#include <fmt/compile.h>
+#include <fmt/format.h>
+
+#include "Common.hpp"
+
+namespace mmd {
+
+/**
+ * @brief Knobs for the admission stage, filled from the command line
+ */
+struct AdmissionSettings
+{
+    uint64_t rate{ config::source_rate }; // packets per second per source, 0 disables the limit
+    uint64_t burst{ config::source_burst }; // bucket depth, packets
+    uint64_t sample{ config::sample_step }; // N for 1-in-N sampling under pressure, <2 disables
+    uint64_t summary_ns{ config::summary_interval_ns }; // how often to report shedding
+    uint64_t quiet{ config::quiet_rate }; // packets/s under which a source isn't sampled, 0: none
+};
+
+/**
+ * @brief Per-source token buckets in a fixed-size open addressing table.
+ * Slots are claimed with a CAS, so lookups never lock and never allocate.
+ * Bucket state itself is only updated by the single receiving thread,
+ * atomics are there so that anyone else may peek at it.
+ * A slot that has been idle long enough for its bucket to be full again
+ * is no different from an empty one, so it goes to a new source that needs it.
+ * Sources that still don't fit into the table share one overflow bucket.
+ */
+class SourceTable
+{
+public:
+    struct Slot
+    {
+        std::atomic<uint64_t> key{ 0 }; // 0 means empty
+        std::atomic<uint64_t> tokens{ 0 }; // in 1/1e9 of a packet
+        std::atomic<uint64_t> last_ns{ 0 }; // last packet, 0 if none yet
+        std::atomic<uint64_t> seq{ 0 }; // counter for the deterministic sampling
+        std::atomic<uint64_t> window_ns{ 0 }; // start of the current rate window, 0 if none yet
+        std::atomic<uint64_t> count{ 0 }; // packets in the current rate window
+        std::atomic<uint64_t> ewma{ 0 }; // smoothed rate over the past windows, packets per second
+    };
+
+    /**
+     * @brief Finds the slot for the source, claiming an empty or a stale one if needed
+     * Slots are never emptied, only reused, so an empty slot ends the probe.
+     * @param now_ns Monotonic time in nanoseconds
+     * @param stale_ns Idle time after which a slot may go to another source
+     * @return Slot for the source, or the overflow slot if the table is full
+     */
+    Slot &lookup(std::string_view addr, uint64_t now_ns, uint64_t stale_ns)
+    {
+        const auto key = sourceKey(addr);
+        Slot *stale{ nullptr };
+        for (size_t i{ 0 }; i < config::source_probe_limit; ++i) {
+            auto &slot = _slots[(key + i) & (_slots.size() - 1)];
+            auto current = slot.key.load(std::memory_order::acquire);
+            if (current == key) return slot;
+            if (current == 0
+                && slot.key.compare_exchange_strong(current, key, std::memory_order::acq_rel)) {
+                _sources.fetch_add(1, std::memory_order::relaxed);
+                return slot;
+            }
+            if (current == key) return slot; // somebody claimed it for us
+            if (current == 0) break;
+            const auto last = slot.last_ns.load(std::memory_order::relaxed);
+            if (!stale && last && now_ns > last && now_ns - last >= stale_ns) stale = &slot;
+        }
+        if (!stale) return _overflow;
+
+        // whatever the previous owner had is as good as a full bucket by now
+        stale->key.store(key, std::memory_order::release);
+        stale->tokens.store(0, std::memory_order::relaxed);
+        stale->last_ns.store(0, std::memory_order::relaxed);
+        stale->seq.store(0, std::memory_order::relaxed);
+        stale->window_ns.store(0, std::memory_order::relaxed);
+        stale->count.store(0, std::memory_order::relaxed);
+        stale->ewma.store(0, std::memory_order::relaxed);
+        _reclaimed.fetch_add(1, std::memory_order::relaxed);
+        return *stale;
+    }
+
+    [[nodiscard]] size_t sources() const
+    {
+        return _sources.load(std::memory_order::relaxed);
+    }
+
+    /**
+     * @brief Times a stale slot went to a new source
+     */
+    [[nodiscard]] uint64_t reclaimed() const
+    {
+        return _reclaimed.load(std::memory_order::relaxed);
+    }
+
+private:
+    static_assert((config::source_table_size & (config::source_table_size - 1)) == 0,
+                  "source_table_size is supposed to be a power of two");
+    std::array<Slot, config::source_table_size> _slots{};
+    Slot _overflow{};
+    std::atomic<size_t> _sources{ 0 };
+    std::atomic<uint64_t> _reclaimed{ 0 };
+};
+
+/**
+ * @brief Queue wrapper that decides what gets into the formatter when we're flooded
+ * Every source gets a token bucket; packets without a token are shed.
+ * When the queue fills past half (and then three quarters) of capacity,
+ * every source sending faster than the quiet rate is sampled 1-in-N (1-in-N^2),
+ * whether or not it is within its rate limit, while quiet ones still pass untouched.
+ * How fast a source sends is a per-source moving average over config::rate_window_ns
+ * windows, plus the count in the current window, so a new source can't hide
+ * behind an empty history for longer than one window.
+ * What was shed, and how many payloads were truncated (see stats::truncated),
+ * is periodically pushed downstream as a summary record from "mmdsrv",
+ * along with the spill depth if the queue is a SpillQueue.
+ *
+ * Push and tick are expected to be called from one thread and PopOptional from another,
+ * same as the underlying spsc queue.
+ *
+ * @tparam QueueT Something that is a queue with ReceivedData.
+ * @tparam capacity Number of entries the underlying queue holds.
+ */
+template<typename QueueT, size_t capacity = config::queue_size>
+requires(Queue<QueueT, ReceivedData>) class AdmissionQueue
+{
+public:
+    AdmissionQueue(QueueT &queue, const AdmissionSettings &settings = {})
+        : _queue{ queue }
+        , _settings{ settings }
+        , _stale_ns{ staleNs(settings) }
+        , _reported_truncated{ stats::truncated.load(std::memory_order::relaxed) }
+    {
+    }
+
+    bool Push(const ReceivedData &rdata)
+    {
+        const auto now = nowNs();
+        maybeSummarize(now);
+        if (!admit(rdata, now)) return false;
+        return forward(rdata);
+    }
+
+    /**
+     * @brief Sends the summary if it's due, for when there are no packets to do that
+     * Call periodically from the thread that pushes, see UdpServer.
+     */
+    void tick()
+    {
+        maybeSummarize(nowNs());
+    }
+
+    /**
+     * @brief How often tick is worth calling, 0 if never
+     */
+    [[nodiscard]] uint64_t tickNs() const
+    {
+        return _settings.summary_ns;
+    }
+
+    std::optional<ReceivedData> PopOptional()
+    {
+        auto result = _queue.get().PopOptional();
+        if (result) _popped.fetch_add(1, std::memory_order::relaxed);
+        return result;
+    }
+
+    /**
+     * @brief Applies rate limit and sampling, doesn't touch the queue
+     * Public so that the policy can be tested without a clock.
+     * @param now_ns Monotonic time in nanoseconds
+     * @return true if the packet may go to the queue
+     */
+    bool admit(const ReceivedData &rdata, uint64_t now_ns)
+    {
+        auto &slot = _table.lookup({ rdata.addr, rdata.addrsize }, now_ns, _stale_ns);
+
+        if (_settings.rate) {
+            const auto full = _settings.burst * _nano;
+            const auto last = slot.last_ns.load(std::memory_order::relaxed);
+            auto tokens = slot.tokens.load(std::memory_order::relaxed);
+            if (last == 0) {
+                tokens = full; // new source starts with a full bucket
+            } else if (now_ns > last) {
+                const auto fill_ns = full / _settings.rate; // time to refill from empty
+                tokens = std::min(full, tokens + std::min(now_ns - last, fill_ns) * _settings.rate);
+            }
+            slot.last_ns.store(now_ns, std::memory_order::relaxed);
+            if (tokens < _nano) {
+                slot.tokens.store(tokens, std::memory_order::relaxed);
+                _shed_rate++;
+                return false;
+            }
+            tokens -= _nano;
+            slot.tokens.store(tokens, std::memory_order::relaxed);
+        } else {
+            slot.last_ns.store(now_ns, std::memory_order::relaxed); // for staleness only
+        }
+
+        const bool quiet = countRate(slot, now_ns);
+        const auto step = samplingStep();
+        if (step > 1 && !quiet) {
+            const auto seq = slot.seq.fetch_add(1, std::memory_order::relaxed);
+            if (seq % step != 0) {
+                _shed_sample++;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Current 1-in-N step, 1 means everything passes
+     * With a SpillQueue the queue and the spill file are measured each against its own size,
+     * and the fuller of the two decides.
+     */
+    [[nodiscard]] uint64_t samplingStep() const
+    {
+        if (_settings.sample < 2) return 1;
+        const auto occ = occupancy();
+        bool half = occ * 2 >= capacity;
+        bool three_quarters = occ * 4 >= capacity * 3;
+        if constexpr (requires(const QueueT &q) {
+                          q.depthBytes();
+                          q.capacityBytes();
+                      }) {
+            const auto used = _queue.get().depthBytes();
+            const auto size = _queue.get().capacityBytes();
+            half = half || (size && used * 2 >= size);
+            three_quarters = three_quarters || (size && used * 4 >= size * 3);
+        }
+        if (three_quarters) return _settings.sample * _settings.sample;
+        if (half) return _settings.sample;
+        return 1;
+    }
+
+    /**
+     * @brief Entries in the queue, not counting the ones a SpillQueue has put into its file
+     */
+    [[nodiscard]] size_t occupancy() const
+    {
+        if constexpr (requires(const QueueT &q) { q.queued(); }) {
+            return _queue.get().queued();
+        } else {
+            return _pushed.load(std::memory_order::relaxed)
+                    - _popped.load(std::memory_order::relaxed);
+        }
+    }
+
+    [[nodiscard]] uint64_t shedByRate() const
+    {
+        return _shed_rate;
+    }
+
+    [[nodiscard]] uint64_t shedBySampling() const
+    {
+        return _shed_sample;
+    }
+
+    [[nodiscard]] uint64_t shedByQueue() const
+    {
+        return _shed_queue;
+    }
+
+private:
+    static uint64_t nowNs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                             std::chrono::steady_clock::now().time_since_epoch())
+                                             .count());
+    }
+
+    /**
+     * @brief Counts the packet into the source's rate, tells if the source is still quiet
+     * Counted before sampling, so that being sampled doesn't make a source look quiet.
+     * Each window that ends halves the average and adds half of its own rate,
+     * empty windows only halve it.
+     */
+    bool countRate(SourceTable::Slot &slot, uint64_t now_ns)
+    {
+        constexpr auto window = config::rate_window_ns;
+        auto start = slot.window_ns.load(std::memory_order::relaxed);
+        auto count = slot.count.load(std::memory_order::relaxed);
+        auto ewma = slot.ewma.load(std::memory_order::relaxed);
+        if (start == 0) {
+            start = now_ns;
+        } else if (const auto windows = now_ns > start ? (now_ns - start) / window : 0;
+                   windows > 0) {
+            ewma = (ewma + count * (_nano / window)) / 2;
+            ewma >>= std::min<uint64_t>(windows - 1, 63);
+            start += windows * window;
+            count = 0;
+        }
+        count++;
+        slot.window_ns.store(start, std::memory_order::relaxed);
+        slot.count.store(count, std::memory_order::relaxed);
+        slot.ewma.store(ewma, std::memory_order::relaxed);
+
+        return ewma < _settings.quiet && count * _nano <= _settings.quiet * window;
+    }
+
+    /**
+     * @brief How long a source has to be idle for its slot to be reused
+     * A few times as long as it takes to refill the bucket from empty.
+     */
+    static uint64_t staleNs(const AdmissionSettings &settings)
+    {
+        if (!settings.rate) return config::source_stale_ns;
+        const auto fill_ns = std::max<uint64_t>(1, settings.burst * _nano / settings.rate);
+        return fill_ns * config::source_stale_fills;
+    }
+
+    bool forward(const ReceivedData &rdata)
+    {
+        // counted before the push, so that the consumer never pops more than was pushed
+        _pushed.fetch_add(1, std::memory_order::relaxed);
+        if (!_queue.get().Push(rdata)) {
+            _pushed.fetch_sub(1, std::memory_order::relaxed);
+            _shed_queue++;
+            return false;
+        }
+        return true;
+    }
+
+    void maybeSummarize(uint64_t now_ns)
+    {
+        if (_last_summary == 0) _last_summary = now_ns;
+        if (now_ns - _last_summary < _settings.summary_ns) return;
+
+        const auto rate = _shed_rate - _reported_rate;
+        const auto sample = _shed_sample - _reported_sample;
+        const auto queue = _shed_queue - _reported_queue;
+        const auto truncated = stats::truncated.load(std::memory_order::relaxed);
+        const auto cut = truncated - _reported_truncated;
+        _last_summary = now_ns;
+        uint64_t spill{ 0 };
+        size_t spill_bytes{ 0 };
+        if constexpr (requires(const QueueT &q) {
+                          q.depth();
+                          q.depthBytes();
+                      }) {
+            spill = _queue.get().depth();
+            spill_bytes = _queue.get().depthBytes();
+        }
+        if (rate == 0 && sample == 0 && queue == 0 && cut == 0 && spill == 0) return;
+
+        static constexpr std::string_view self{ "mmdsrv" };
+        ReceivedData summary{};
+        summary.timestamp =
+                std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        summary.addrsize = self.size();
+        std::copy(self.begin(), self.end(), summary.addr);
+        const auto end = fmt::format_to_n(
+                summary.data, sizeof(summary.data),
+                FMT_COMPILE("shed;rate;{};sample;{};queue;{};truncated;{};sources;{};step;{};"
+                            "spill;{};spillbytes;{}"),
+                rate, sample, queue, cut, _table.sources(), samplingStep(), spill, spill_bytes);
+        summary.datasize = end.size;
+
+        // if it didn't fit, counts stay unreported and go into the next one
+        if (forward(summary)) {
+            _reported_rate += rate;
+            _reported_sample += sample;
+            _reported_queue += queue;
+            _reported_truncated = truncated;
+        }
+    }
+
+    static constexpr uint64_t _nano{ 1'000'000'000 };
+
+    std::reference_wrapper<QueueT> _queue;
+    AdmissionSettings _settings;
+    uint64_t _stale_ns;
+    SourceTable _table{};
+    std::atomic<size_t> _pushed{ 0 };
+    std::atomic<size_t> _popped{ 0 };
+    uint64_t _shed_rate{ 0 };
+    uint64_t _shed_sample{ 0 };
+    uint64_t _shed_queue{ 0 };
+    uint64_t _reported_rate{ 0 };
+    uint64_t _reported_sample{ 0 };
+    uint64_t _reported_queue{ 0 };
+    uint64_t _reported_truncated;
+    uint64_t _last_summary{ 0 };
+};
+
+static_assert(Queue<AdmissionQueue<ReceiverQueue>, ReceivedData>,
+              "AdmissionQueue is supposed to be a Queue");
+
+} // namespace mmd
+
+#endif // ADMISSIONQUEUE_HPP_
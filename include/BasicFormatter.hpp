@@ -6,47 +6,63 @@
 #define BASICFORMATTER_HPP_
 
 #include "FormatWorker.hpp" // for Formatter concept
+#include "OutputEncoder.hpp"
 
 namespace mmd {
 
-enum class DataType {
-    Ascii,
-    Utf8,
-    Binary,
-};
-
+/**
+ * @tparam Format Output format, picked once at startup; see Encoder for what each one writes
+ */
+template<OutputFormat Format = OutputFormat::Plain>
 class BasicFormatter
 {
 public:
-    BasicFormatter(const std::string &filter_string = "")
+    /**
+     * @param arena Where to put records too big for FormattedData, truncated if nullptr
+     */
+    BasicFormatter(const std::string &filter_string = "", BufferArena *arena = nullptr)
         : _filter_string{ filter_string }
+        , _arena{ arena }
     {
     }
 
     FormattedData format(const ReceivedData &rdata) const
     {
         FormattedData fdata{};
-        const auto data_type = detectDataType(rdata.data, rdata.datasize);
-
-        if (data_type == DataType::Ascii && !passesFilter(rdata.data, rdata.datasize)) return fdata;
-
-        const auto formattedSize = [data_type, &fdata, &rdata] {
-            if (data_type == DataType::Binary) {
-                return fmt::format_to(
-                        std::begin(fdata.data), FMT_COMPILE("ts;{};addr;{};type;bin;data;{:02x}\n"),
-                        rdata.timestamp,
-                        fmt::join(std::span(std::begin(rdata.addr), rdata.addrsize), ""),
-                        fmt::join(std::span(std::begin(rdata.data), rdata.datasize), ""));
-            } else {
-                return fmt::format_to(
-                        std::begin(fdata.data), FMT_COMPILE("ts;{};addr;{};type;{};data;{:s}\n"),
-                        rdata.timestamp,
-                        fmt::join(std::span(std::begin(rdata.addr), rdata.addrsize), ""),
-                        (data_type == DataType::Ascii ? "ascii" : "utf8"),
-                        std::span(std::begin(rdata.data), rdata.datasize));
+        const auto *payload = rdata.payload();
+        const auto data_type = detectDataType(payload, rdata.datasize);
+
+        if (data_type == DataType::Ascii && !passesFilter(payload, rdata.datasize)) return fdata;
+
+        // hex encoding takes 2 chars per byte, text takes what the escapes take
+        const bool binary = data_type == DataType::Binary;
+        const size_t encoded = binary ? rdata.datasize * 2
+                                      : Encoder<Format>::textSize(payload, rdata.datasize);
+        char *out = fdata.data;
+        size_t capacity = sizeof(fdata.data);
+        size_t size = rdata.datasize;
+        if (_header_reserve + encoded > capacity) {
+            if (_arena && (fdata.large = _arena->acquire(_header_reserve + encoded))) {
+                out = fdata.large;
+                capacity = BufferArena::capacity(fdata.large);
+            }
+            if (_header_reserve + encoded > capacity) {
+                // as much as fits once encoded, not as much as would fit if all of it was escapes
+                const auto room = capacity - _header_reserve;
+                size = binary ? room / 2 : Encoder<Format>::textPrefix(payload, size, room);
+                // and not in the middle of a character
+                while (data_type == DataType::Utf8 && size > 0
+                       && (static_cast<unsigned char>(payload[size]) & 0xC0) == 0x80) {
+                    size--;
+                }
+                stats::truncated.fetch_add(1, std::memory_order::relaxed);
             }
-        }();
-        fdata.datasize = std::distance(fdata.data, formattedSize);
+        }
+
+        const auto formattedSize = Encoder<Format>::write(out, rdata, data_type, payload, size);
+        fdata.datasize = std::distance(out, formattedSize);
+        fdata.timestamp = rdata.timestamp;
+        fdata.source = sourceKey({ rdata.addr, rdata.addrsize });
         return fdata;
     }
 
@@ -99,11 +115,17 @@ public:
     }
 
 private:
+    // longest "ts;...;addr;...;type;...;data;" and "\n" we may write, or its CSV/JSON twin
+    static constexpr size_t _header_reserve{ 128 };
+
     std::string _filter_string{ "" };
+    BufferArena *_arena{ nullptr };
 };
 
 // to check that we meet the concept requirements
-static_assert(Formatter<BasicFormatter>, "Formatter is not a formatter");
+static_assert(Formatter<BasicFormatter<>>, "Formatter is not a formatter");
+static_assert(Formatter<BasicFormatter<OutputFormat::Csv>>, "Formatter is not a formatter");
+static_assert(Formatter<BasicFormatter<OutputFormat::Json>>, "Formatter is not a formatter");
 
 } // namespace mmd
 
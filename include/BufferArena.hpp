@@ -0,0 +1,170 @@
+/**
+ * @file BufferArena.hpp
+ * @brief Contains implementation of a pool of big buffers for out of line payloads.
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef BUFFERARENA_HPP_
+#define BUFFERARENA_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+namespace mmd {
+
+/**
+ * @brief Fixed pool of buffers in a few size classes, allocated once.
+ * Used for the rare payloads that don't fit into ReceivedData and FormattedData,
+ * so that those can stay small and trivial.
+ * A request gets a buffer of the smallest class that fits it and still has one free,
+ * so a jumbo frame doesn't take a buffer meant for a 64 KiB datagram.
+ * Free buffers of each class are kept in a lock-free stack with a tag against ABA,
+ * so any thread may acquire and any thread may release.
+ * Every buffer knows its class, so release() doesn't need the arena.
+ */
+class BufferArena
+{
+public:
+    BufferArena(size_t buffer_size, size_t count)
+        : BufferArena({ buffer_size }, count)
+    {
+    }
+
+    /**
+     * @param sizes Buffer size of each class
+     * @param count Buffers in each class
+     */
+    BufferArena(std::initializer_list<size_t> sizes, size_t count)
+    {
+        std::vector<size_t> sorted(sizes);
+        std::sort(sorted.begin(), sorted.end());
+        for (const auto size : sorted) _classes.push_back(std::make_unique<SizeClass>(size, count));
+    }
+
+    BufferArena(const BufferArena &) = delete;
+    BufferArena &operator=(const BufferArena &) = delete;
+
+    /**
+     * @brief Takes a buffer of the biggest class
+     * @return Buffer of bufferSize() bytes, or nullptr if all of them are in use
+     */
+    char *acquire()
+    {
+        return _classes.back()->pop();
+    }
+
+    /**
+     * @brief Takes a buffer of at least size bytes
+     * @return Buffer of capacity(buffer) >= size bytes, or nullptr if there's none left
+     */
+    char *acquire(size_t size)
+    {
+        for (auto &size_class : _classes) {
+            if (size_class->buffer_size < size) continue;
+            if (auto *buffer = size_class->pop(); buffer) return buffer;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Returns the buffer to its arena, nullptr is fine and does nothing
+     */
+    static void release(char *buffer)
+    {
+        if (!buffer) return;
+        const auto *header = reinterpret_cast<const Header *>(buffer - sizeof(Header));
+        header->owner->push(header->index);
+    }
+
+    /**
+     * @brief Size of the buffer, which may be more than what was asked for
+     */
+    static size_t capacity(const char *buffer)
+    {
+        return reinterpret_cast<const Header *>(buffer - sizeof(Header))->owner->buffer_size;
+    }
+
+    /**
+     * @brief Size of the biggest buffers
+     */
+    [[nodiscard]] size_t bufferSize() const
+    {
+        return _classes.back()->buffer_size;
+    }
+
+private:
+    struct SizeClass;
+
+    struct alignas(std::max_align_t) Header
+    {
+        SizeClass *owner;
+        uint32_t index;
+    };
+
+    struct SizeClass
+    {
+        SizeClass(size_t size, size_t count)
+            : buffer_size{ size }
+            , stride{ (sizeof(Header) + size + alignof(std::max_align_t) - 1)
+                      & ~(alignof(std::max_align_t) - 1) }
+            , count{ static_cast<uint32_t>(count) }
+            , memory{ new char[stride * count] }
+            , next{ new std::atomic<uint32_t>[count] }
+        {
+            for (uint32_t i{ 0 }; i < this->count; ++i) {
+                auto *header = reinterpret_cast<Header *>(memory.get() + i * stride);
+                header->owner = this;
+                header->index = i;
+                next[i].store(i + 1, std::memory_order::relaxed);
+            }
+            head.store(0, std::memory_order::release); // all buffers free, tag 0
+        }
+
+        char *pop()
+        {
+            auto current = head.load(std::memory_order::acquire);
+            for (;;) {
+                const auto index = static_cast<uint32_t>(current);
+                if (index >= count) return nullptr;
+                const auto after = next[index].load(std::memory_order::relaxed);
+                const auto tagged = ((current >> 32) + 1) << 32 | after;
+                if (head.compare_exchange_weak(current, tagged, std::memory_order::acq_rel)) {
+                    return memory.get() + index * stride + sizeof(Header);
+                }
+            }
+        }
+
+        void push(uint32_t index)
+        {
+            auto current = head.load(std::memory_order::relaxed);
+            for (;;) {
+                next[index].store(static_cast<uint32_t>(current), std::memory_order::relaxed);
+                const auto tagged = ((current >> 32) + 1) << 32 | index;
+                if (head.compare_exchange_weak(current, tagged, std::memory_order::acq_rel)) {
+                    return;
+                }
+            }
+        }
+
+        size_t buffer_size;
+        size_t stride;
+        uint32_t count;
+        std::unique_ptr<char[]> memory;
+        std::unique_ptr<std::atomic<uint32_t>[]> next; // free list links, count means end
+        std::atomic<uint64_t> head{ 0 }; // tag in the upper half, index in the lower one
+    };
+
+    std::vector<std::unique_ptr<SizeClass>> _classes;
+};
+
+} // namespace mmd
+
+#endif // BUFFERARENA_HPP_
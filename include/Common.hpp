@@ -10,11 +10,18 @@
 #ifndef COMMON_HPP_
 #define COMMON_HPP_
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <cstring>
+#include <string>
+#include <string_view>
 
 #include <lockfree.hpp>
 
+#include "BufferArena.hpp"
+
 namespace mmd {
 namespace config {
 
@@ -24,8 +31,100 @@ namespace config {
  */
 static constexpr size_t buf_size{ 1500 }; 
 
+/**
+ * @brief Biggest payload a UDP datagram can have
+ * Anything over buf_size goes out of line, into a BufferArena buffer
+ */
+static constexpr size_t max_datagram_size{ 65535 };
+
+/**
+ * @brief Number of entries in the queues between server, formatter and writer
+ */
+static constexpr size_t queue_size{ 64 };
+
+/**
+ * @brief Out of line buffers, in two size classes: one for a hex encoded jumbo frame,
+ * one big enough for a hex encoded max_datagram_size plus header.
+ * Either class alone covers every entry that can be in flight:
+ * both queues full, plus the ones being received, formatted and written.
+ */
+static constexpr size_t jumbo_buffer_size{ 24 * 1024 };
+static constexpr size_t large_buffer_size{ max_datagram_size * 2 + 256 };
+static constexpr size_t large_buffer_count{ queue_size * 2 + 8 };
+
+/**
+ * @brief Max datagrams taken off the socket before going back to the io_context
+ */
+static constexpr size_t receive_batch{ 64 };
+
+/**
+ * @brief Max formatted bytes the single-threaded mode keeps while a write is in flight,
+ * see CoroutinePipeline
+ */
+static constexpr size_t pending_limit{ 4 * 1024 * 1024 };
+
+/**
+ * @brief Defaults for the overload protection, see AdmissionQueue
+ */
+static constexpr uint64_t source_rate{ 10000 }; // packets per second per source
+static constexpr uint64_t source_burst{ 1000 }; // packets a source may send at once
+static constexpr uint64_t sample_step{ 8 }; // 1-in-N under pressure
+static constexpr uint64_t quiet_rate{ 100 }; // packets per second, sources below it aren't sampled
+static constexpr uint64_t rate_window_ns{ 100'000'000 }; // window of the per-source rate average
+static constexpr uint64_t summary_interval_ns{ 1'000'000'000 }; // once a second
+static constexpr size_t source_table_size{ 1024 }; // max distinct sources tracked, power of two
+static constexpr size_t source_probe_limit{ 16 }; // before giving up and using overflow bucket
+static constexpr uint64_t source_stale_fills{ 4 }; // idle refill periods before a slot is reused
+static constexpr uint64_t source_stale_ns{ 10'000'000'000 }; // same, when there's no rate limit
+
+/**
+ * @brief Log bytes covered by one entry of the sidecar index, see LogIndex
+ */
+static constexpr size_t index_block_size{ 64 * 1024 };
+
+/**
+ * @brief Data bytes of the shared memory ring, see ShmRing
+ */
+static constexpr size_t shm_ring_size{ 16 * 1024 * 1024 };
+
+/**
+ * @brief Default size of the file the receiver queue spills to, MiB, see SpillQueue
+ * None unless asked for: all of it is taken on disk at start, and small hosts may not have it.
+ */
+static constexpr size_t spill_size_mb{ 0 };
+
 } // namespace config
 
+namespace stats {
+
+/**
+ * @brief Payloads cut short, or dropped, because they didn't fit anywhere
+ * Bumped wherever that happens, reported in the admission summary and on exit.
+ */
+inline std::atomic<uint64_t> truncated{ 0 };
+
+/**
+ * @brief Records not published to the shared memory ring because they're too big for it
+ * Only the shm consumers miss them, they're in the log all the same. Reported on exit.
+ */
+inline std::atomic<uint64_t> unpublished{ 0 };
+
+} // namespace stats
+
+/**
+ * @brief Key identifying a sender, hash of its address string
+ * FNV-1a, good enough for a handful of addresses; never 0.
+ */
+inline uint64_t sourceKey(std::string_view addr)
+{
+    uint64_t h{ 14695981039346656037ull };
+    for (const auto c : addr) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    return h ? h : 1;
+}
+
 /**
  * @brief Represents things that would be received from the network
  * Made a trivial type for 
@@ -34,35 +133,64 @@ static constexpr size_t buf_size{ 1500 };
  */
 struct ReceivedData
 {
-    ReceivedData(const std::string &address, char *datap, size_t datas)
+    /**
+     * @brief Copies the payload, out of line if it's bigger than buf_size
+     * If there's no arena, or it's used up, big payloads are truncated to buf_size.
+     * The out of line buffer is owned by whoever holds the data,
+     * and has to be given back with BufferArena::release(large).
+     */
+    ReceivedData(const std::string &address, char *datap, size_t datas,
+                 BufferArena *arena = nullptr)
         : timestamp(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()))
         , addrsize(address.size())
         , datasize(datas)
+        , large(nullptr)
     {
         memcpy(&addr, address.data(), addrsize);
-        memcpy(&data, datap, datas);
+        if (datasize > config::buf_size && arena) large = arena->acquire(datasize);
+        if (large) {
+            memcpy(large, datap, datasize);
+        } else {
+            if (datasize > config::buf_size) {
+                stats::truncated.fetch_add(1, std::memory_order::relaxed);
+            }
+            datasize = std::min(datasize, config::buf_size);
+            memcpy(&data, datap, datasize);
+        }
     }
     ReceivedData() = default; // to force triviality
+    [[nodiscard]] const char *payload() const
+    {
+        return large ? large : data;
+    }
     size_t timestamp; // TODO: we want better precision, perhaps?
     size_t addrsize;
     size_t datasize;
+    char *large; // payload, if it didn't fit into data
     char addr[8 * 4 + 8]; // is this the max length of a ipv6 address + 1?
     char data[config::buf_size];
 };
 
 /**
  * @brief Represents things that would be saved to a file
- * Also a trivial type
+ * Also a trivial type, with the same out of line trick as ReceivedData
  */
 struct FormattedData
 {
+    size_t timestamp; // copied from ReceivedData, for the index
+    uint64_t source; // sourceKey of the sender, for the index
     size_t datasize;
+    char *large; // formatted record from a BufferArena, if it didn't fit into data
+    [[nodiscard]] std::string_view view() const
+    {
+        return { large ? large : data, datasize };
+    }
     char data[config::buf_size * 3]; // 2 per byte for hex encoding of 1 byte, plus "header", plus nalogi, plus dostavka, plus na pivo 
 };
 
 // Type aliases, saves keystrokes to write more comments
-using ReceiverQueue = lockfree::spsc::Queue<ReceivedData, 64>;
-using FormatterQueue = lockfree ::spsc::Queue<FormattedData, 64>;
+using ReceiverQueue = lockfree::spsc::Queue<ReceivedData, config::queue_size>;
+using FormatterQueue = lockfree ::spsc::Queue<FormattedData, config::queue_size>;
 
 /**
  * @brief Concept for cheking the Queue PopOptional and Push
@@ -0,0 +1,254 @@
+/**
+ * @file CoroutinePipeline.hpp
+ * @brief Contains implementation of the single-threaded receive-format-write pipeline.
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef COROUTINEPIPELINE_HPP_
+#define COROUTINEPIPELINE_HPP_
+
+#include <asio/awaitable.hpp>
+#include <asio/co_spawn.hpp>
+#include <asio/post.hpp>
+#include <asio/redirect_error.hpp>
+#include <asio/steady_timer.hpp>
+#include <asio/ts/buffer.hpp>
+#include <asio/ts/internet.hpp>
+#include <asio/use_awaitable.hpp>
+#if defined(ASIO_HAS_FILE)
+#include <asio/stream_file.hpp>
+#include <asio/write.hpp>
+#endif
+#include <exception>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "Common.hpp"
+#include "DatagramReceiver.hpp"
+#include "FileDataWriter.hpp"
+#include "FormatWorker.hpp" // for Formatter concept
+#include "LogIndex.hpp"
+
+namespace mmd {
+
+/**
+ * @brief Whole pipeline as two coroutines on somebody else's io_context
+ * Meant for small hosts, where FormatWorker and the writer thread
+ * grinding their queues cost more than they bring.
+ * The receiver sleeps until the socket is readable, then drains up to
+ * config::receive_batch reads and formats them right away.
+ * The writer wakes up when there is formatted data and writes all of it in one go.
+ * With io_uring (asio built with ASIO_HAS_IO_URING, see MMD_IO_URING in CMakeLists.txt)
+ * that write is an asio::stream_file async_write, so receiving goes on while the disk is busy,
+ * and several receive batches end up in the next write, up to config::pending_limit bytes;
+ * past that the receiver waits for the write, and the kernel's receive buffer takes the rest.
+ * Without it, the write is a plain blocking FileDataWriter::write on the only thread,
+ * so a slow disk stalls the socket too, and the kernel's receive buffer is all the slack.
+ * Records go to the index once they are written, so it never points past the end of the log.
+ * Nothing spins, an idle pipeline is just an idle io_context.
+ *
+ * @tparam FormatterT Something that implements the Formatter concept.
+ */
+template<Formatter FormatterT>
+class CoroutinePipeline
+{
+public:
+    /**
+     * @param arena Where datagrams bigger than config::buf_size go, truncated if nullptr
+     * @param format What the formatter writes, recorded in the index
+     */
+    CoroutinePipeline(asio::io_context &context, asio::ip::udp::socket &socket,
+                      FormatterT &formatter, const std::string &file_path,
+                      BufferArena *arena = nullptr, OutputFormat format = OutputFormat::Plain)
+        : _context{ context }
+        , _socket{ socket }
+        , _receiver{ socket }
+        , _formatter{ formatter }
+        , _arena{ arena }
+#if defined(ASIO_HAS_FILE)
+        , _file{ context, file_path,
+                 asio::stream_file::write_only | asio::stream_file::create
+                         | asio::stream_file::truncate }
+#else
+        , _fwriter{ file_path }
+#endif
+        , _iwriter{ file_path, format }
+        , _wakeup{ context }
+        , _drained{ context }
+    {
+    }
+
+    /**
+     * @brief Spawns the coroutines, they start once the context runs
+     * Any exception thrown by them comes out of io_context::run().
+     */
+    void start()
+    {
+        _socket.get().non_blocking(true);
+        _receiver.enableGro();
+        const auto rethrow = [](std::exception_ptr eptr) {
+            if (eptr) std::rethrow_exception(eptr);
+        };
+        asio::co_spawn(_context.get(), receive(), rethrow);
+        asio::co_spawn(_context.get(), write(), rethrow);
+    }
+
+    /**
+     * @brief Stops receiving, the writer ends once everything received is written
+     * May be called from any thread; the context's run() returns when they're both done.
+     */
+    void stop()
+    {
+        asio::post(_context.get(), [this] {
+            _stopping = true;
+            _socket.get().cancel();
+            _wakeup.cancel();
+            _drained.cancel();
+        });
+    }
+
+    /**
+     * @brief Writes whatever is still pending and the index, call after the context stopped
+     * After stop() there's nothing pending, this is for a context that was stopped the hard way.
+     */
+    void finish()
+    {
+        writeNow(_pending);
+        _pending.clear();
+        indexWritten(_pending_index);
+        _iwriter.flush();
+    }
+
+private:
+    /**
+     * @brief Where a formatted record is in _pending or _writing, for the index
+     */
+    struct IndexEntry
+    {
+        size_t size;
+        size_t timestamp;
+        uint64_t source;
+    };
+
+    asio::awaitable<void> receive()
+    {
+        for (;;) {
+            asio::error_code ec;
+            // the writer is behind, wait for it rather than pile up formatted records
+            while (_pending.size() >= config::pending_limit && !_stopping) {
+                co_await sleep(_drained);
+            }
+            if (_stopping) co_return;
+            co_await _socket.get().async_wait(asio::ip::udp::socket::wait_read,
+                                              asio::redirect_error(asio::use_awaitable, ec));
+            if (ec) co_return; // cancelled, we're stopping
+
+            const auto format = [this](const asio::ip::udp::endpoint &sender, char *data,
+                                       size_t size) {
+                if (size == 0) return;
+                ReceivedData rdata{ sender.address().to_string(), data, size, _arena };
+                const auto fdata = _formatter.get().format(rdata);
+                BufferArena::release(rdata.large);
+                if (fdata.datasize > 0) {
+                    _pending_index.push_back({ fdata.datasize, fdata.timestamp, fdata.source });
+                    _pending.append(fdata.view());
+                }
+                BufferArena::release(fdata.large);
+            };
+            for (size_t i{ 0 }; i < config::receive_batch && _pending.size() < config::pending_limit
+                 && _receiver.receive(format);
+                 ++i) {
+            }
+
+            if (!_pending.empty()) _wakeup.cancel();
+        }
+    }
+
+    asio::awaitable<void> write()
+    {
+        for (;;) {
+            if (_pending.empty()) {
+                if (_stopping) co_return;
+                co_await sleep(_wakeup); // receiver wakes us up
+                continue;
+            }
+            std::swap(_pending, _writing);
+            std::swap(_pending_index, _writing_index);
+#if defined(ASIO_HAS_FILE)
+            // the receiver goes on meanwhile, appending to _pending
+            co_await asio::async_write(_file, asio::buffer(_writing), asio::use_awaitable);
+            _writing.clear();
+            indexWritten(_writing_index);
+            _drained.cancel();
+#else
+            writeNow(_writing);
+            _writing.clear();
+            indexWritten(_writing_index);
+            _drained.cancel();
+            // let the receiver have a go before the next write
+            co_await asio::post(_context.get(), asio::use_awaitable);
+#endif
+        }
+    }
+
+    /**
+     * @brief Waits on a timer that never fires, until somebody cancels it
+     */
+    asio::awaitable<void> sleep(asio::steady_timer &timer)
+    {
+        asio::error_code ec;
+        timer.expires_at(asio::steady_timer::time_point::max());
+        co_await timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+    }
+
+    /**
+     * @brief Adds records to the index once their bytes are in the log, in the order written
+     */
+    void indexWritten(std::vector<IndexEntry> &entries)
+    {
+        for (const auto &entry : entries) {
+            _iwriter.add(_offset, entry.size, entry.timestamp, entry.source);
+            _offset += entry.size;
+        }
+        entries.clear();
+    }
+
+    void writeNow(std::string_view data)
+    {
+#if defined(ASIO_HAS_FILE)
+        asio::write(_file, asio::buffer(data));
+#else
+        _fwriter.write(data);
+#endif
+    }
+
+    std::reference_wrapper<asio::io_context> _context;
+    std::reference_wrapper<asio::ip::udp::socket> _socket;
+    DatagramReceiver _receiver;
+    std::reference_wrapper<FormatterT> _formatter;
+    BufferArena *_arena;
+#if defined(ASIO_HAS_FILE)
+    asio::stream_file _file;
+#else
+    FileDataWriter _fwriter;
+#endif
+    IndexWriter _iwriter;
+    asio::steady_timer _wakeup; // writer sleeps on it while there's nothing to write
+    asio::steady_timer _drained; // receiver sleeps on it while _pending is over the limit
+    size_t _offset{ 0 }; // where the next written record is in the file
+    bool _stopping{ false };
+    std::string _pending; // formatted, not written yet
+    std::string _writing; // being written, swapped with _pending
+    std::vector<IndexEntry> _pending_index; // records in _pending
+    std::vector<IndexEntry> _writing_index; // records in _writing
+};
+
+} // namespace mmd
+
+#endif // COROUTINEPIPELINE_HPP_
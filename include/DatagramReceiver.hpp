@@ -0,0 +1,124 @@
+/**
+ * @file DatagramReceiver.hpp
+ * @brief Contains implementation of a non-blocking reader of full size and GRO datagrams.
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef DATAGRAMRECEIVER_HPP_
+#define DATAGRAMRECEIVER_HPP_
+
+#include <algorithm>
+#include <asio/ts/internet.hpp>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <utility>
+
+#include "Common.hpp"
+
+namespace mmd {
+
+/**
+ * @brief Reads datagrams of up to max_datagram_size from a socket, without blocking.
+ * asio's receive_from can't tell us about UDP_GRO, so this one goes for recvmsg.
+ * With GRO on, the kernel glues several datagrams from one sender into one read
+ * and tells the segment size in a cmsg; those get split back here.
+ */
+class DatagramReceiver
+{
+public:
+    DatagramReceiver(asio::ip::udp::socket &socket)
+        : _socket{ socket }
+    {
+    }
+
+    /**
+     * @brief Asks the kernel to coalesce datagrams
+     * @return false if the kernel can't, which is fine, just slower
+     */
+    bool enableGro()
+    {
+#ifdef UDP_GRO
+        int on{ 1 };
+        return ::setsockopt(_socket.get().native_handle(), SOL_UDP, UDP_GRO, &on, sizeof(on))
+                == 0;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Reads one datagram, or one GRO bunch of them
+     * @param on_datagram Called as on_datagram(sender, data, size) for each datagram,
+     * data is only valid during the call
+     * @return false if there was nothing to read
+     */
+    template<typename F>
+    bool receive(F &&on_datagram)
+    {
+        iovec iov{ _buffer, sizeof(_buffer) };
+        msghdr msg{};
+        msg.msg_name = _sender.data();
+        msg.msg_namelen = static_cast<socklen_t>(_sender.capacity());
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = _control;
+        msg.msg_controllen = sizeof(_control);
+
+        const auto bytes_recvd = ::recvmsg(_socket.get().native_handle(), &msg, MSG_DONTWAIT);
+        if (bytes_recvd == -1) {
+            // anything else, like ICMP errors, is skipped, same as before
+            return errno != EAGAIN && errno != EWOULDBLOCK;
+        }
+        _sender.resize(msg.msg_namelen);
+
+        auto segment = static_cast<size_t>(bytes_recvd);
+#ifdef UDP_GRO
+        for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int gso_size{ 0 };
+                std::memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                if (gso_size > 0) segment = static_cast<size_t>(gso_size);
+            }
+        }
+#endif
+        // a cut datagram is only ever the last one, and it's not passed on as if it were whole
+        const bool cut = msg.msg_flags & MSG_TRUNC;
+        const auto total = static_cast<size_t>(bytes_recvd);
+        for (size_t offset{ 0 }; offset < total; offset += segment) {
+            const auto size = std::min(segment, total - offset);
+            if (cut && offset + size == total) {
+                _truncated++;
+                stats::truncated.fetch_add(1, std::memory_order::relaxed);
+                break;
+            }
+            on_datagram(std::as_const(_sender), _buffer + offset, size);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Datagrams dropped because they didn't fit into the buffer
+     */
+    [[nodiscard]] uint64_t truncated() const
+    {
+        return _truncated;
+    }
+
+private:
+    std::reference_wrapper<asio::ip::udp::socket> _socket;
+    asio::ip::udp::endpoint _sender;
+    alignas(cmsghdr) char _control[CMSG_SPACE(sizeof(int))];
+    char _buffer[config::max_datagram_size];
+    uint64_t _truncated{ 0 };
+};
+
+} // namespace mmd
+
+#endif // DATAGRAMRECEIVER_HPP_
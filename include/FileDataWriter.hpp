@@ -53,10 +53,20 @@ public:
             }
             total_written += bytes_written;
         }
+        _offset += total_written;
+    }
+
+    /**
+     * @brief Number of bytes written so far, i.e. where the next write lands
+     */
+    [[nodiscard]] size_t offset() const
+    {
+        return _offset;
     }
 
 private:
     int _fd; // File descriptor
+    size_t _offset{ 0 };
 };
 } // namespace mmd
 
@@ -62,7 +62,12 @@ public:
             if (const auto rec = _rqueue.get().PopOptional(); rec) {
                 auto rdata = rec.value();
                 auto fdata = _formatter.get().format(rdata);
-                [[maybe_unused]] const auto pr = _fqueue.get().Push(std::move(fdata));
+                BufferArena::release(rdata.large);
+                // wait for the writer rather than drop: the receiving side has
+                // the admission policy and the spill file to deal with the backlog
+                auto pr = _fqueue.get().Push(fdata);
+                while (!pr && !_stop) pr = _fqueue.get().Push(fdata);
+                if (!pr) BufferArena::release(fdata.large);
 #ifdef BENCHMARK_LOGS
                 if (!pr) fmt::print("ffull\n");
 #endif
@@ -0,0 +1,237 @@
+/**
+ * @file LogIndex.hpp
+ * @brief Contains implementation of the sidecar index for the log file.
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef LOGINDEX_HPP_
+#define LOGINDEX_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "Common.hpp"
+#include "FileDataWriter.hpp"
+#include "MappedFile.hpp"
+#include "OutputEncoder.hpp" // for OutputFormat
+
+namespace mmd {
+namespace index {
+
+/**
+ * @brief Index lives next to the log, with this appended to the log name
+ */
+static constexpr char suffix[] = ".idx";
+
+static constexpr char magic[8] = { 'M', 'M', 'D', 'I', 'D', 'X', '2', '\0' };
+
+/**
+ * @brief Start of the index file
+ */
+struct Header
+{
+    char magic[8];
+    uint64_t block_size;
+    uint64_t format; // OutputFormat of the log
+};
+
+static constexpr size_t bloom_words{ 8 }; // 512 bits
+static constexpr size_t bloom_hashes{ 3 };
+
+/**
+ * @brief One checkpoint of the index, covers a block of consecutive records.
+ * offset always points to the beginning of a record.
+ * Sources are in a bloom filter, so "maybe" is the best we can say about them.
+ */
+struct Block
+{
+    uint64_t offset;
+    uint64_t size;
+    uint64_t ts_min;
+    uint64_t ts_max;
+    uint64_t records;
+    uint64_t bloom[bloom_words];
+};
+
+inline void bloomAdd(Block &block, uint64_t key)
+{
+    const uint64_t step = (key >> 32) | 1;
+    for (size_t i{ 0 }; i < bloom_hashes; ++i) {
+        const auto bit = (key + i * step) % (bloom_words * 64);
+        block.bloom[bit / 64] |= uint64_t{ 1 } << (bit % 64);
+    }
+}
+
+inline bool bloomMayContain(const Block &block, uint64_t key)
+{
+    const uint64_t step = (key >> 32) | 1;
+    for (size_t i{ 0 }; i < bloom_hashes; ++i) {
+        const auto bit = (key + i * step) % (bloom_words * 64);
+        if (!(block.bloom[bit / 64] & (uint64_t{ 1 } << (bit % 64)))) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Tells the format of a log from how its first record starts, for logs without an index
+ */
+inline OutputFormat guessFormat(std::string_view log)
+{
+    if (log.starts_with('{')) return OutputFormat::Json;
+    if (!log.empty() && log.front() >= '0' && log.front() <= '9') return OutputFormat::Csv;
+    return OutputFormat::Plain;
+}
+
+} // namespace index
+
+/**
+ * @brief RAII writer of the sidecar index.
+ * Gets told about every record written to the log and appends one
+ * index::Block per block_size bytes of the log, so the cost is a few
+ * bit operations per record plus a ~100 bytes write per block.
+ * The last, incomplete block is written on destruction;
+ * if that never happens, readers just scan the unindexed tail.
+ */
+class IndexWriter
+{
+public:
+    /**
+     * @param format What the log is written in, so that readers know what they're reading
+     */
+    IndexWriter(const std::string &log_path, OutputFormat format = OutputFormat::Plain,
+                size_t block_size = config::index_block_size)
+        : _file{ log_path + index::suffix }
+        , _block_size{ block_size }
+    {
+        index::Header header{};
+        std::memcpy(header.magic, index::magic, sizeof(header.magic));
+        header.block_size = _block_size;
+        header.format = static_cast<uint64_t>(format);
+        _file.write({ reinterpret_cast<const char *>(&header), sizeof(header) });
+        reset(0);
+    }
+
+    IndexWriter(const IndexWriter &) = delete;
+    IndexWriter &operator=(const IndexWriter &) = delete;
+
+    ~IndexWriter()
+    {
+        try {
+            flush();
+        } catch (...) {
+            // nothing to do about it here, tail stays unindexed
+        }
+    }
+
+    /**
+     * @brief Accounts for one record written to the log
+     * @param offset Where the record starts in the log
+     * @param size Length of the record in bytes
+     */
+    void add(uint64_t offset, size_t size, size_t timestamp, uint64_t source)
+    {
+        if (_block.records == 0) reset(offset);
+        _block.size = offset + size - _block.offset;
+        _block.ts_min = std::min<uint64_t>(_block.ts_min, timestamp);
+        _block.ts_max = std::max<uint64_t>(_block.ts_max, timestamp);
+        _block.records++;
+        index::bloomAdd(_block, source);
+        if (_block.size >= _block_size) flush();
+    }
+
+    /**
+     * @brief Writes out the current block, if there's anything in it
+     */
+    void flush()
+    {
+        if (_block.records == 0) return;
+        _file.write({ reinterpret_cast<const char *>(&_block), sizeof(_block) });
+        reset(_block.offset + _block.size);
+    }
+
+private:
+    void reset(uint64_t offset)
+    {
+        _block = index::Block{};
+        _block.offset = offset;
+        _block.ts_min = std::numeric_limits<uint64_t>::max();
+    }
+
+    FileDataWriter _file;
+    size_t _block_size;
+    index::Block _block{};
+};
+
+/**
+ * @brief Read-only mmap'd view of the sidecar index
+ * Throws if the index is not ours, or from an older mmdsrv.
+ */
+class IndexReader
+{
+public:
+    IndexReader(const std::string &log_path)
+        : _file{ log_path + index::suffix }
+    {
+        const auto data = _file.view();
+        if (data.size() < sizeof(index::Header)
+            || std::memcmp(data.data(), index::magic, sizeof(index::magic)) != 0) {
+            throw std::runtime_error("Not an mmdsrv index file");
+        }
+        const auto count = (data.size() - sizeof(index::Header)) / sizeof(index::Block);
+        _blocks = { reinterpret_cast<const index::Block *>(data.data() + sizeof(index::Header)),
+                    count };
+    }
+
+    [[nodiscard]] std::span<const index::Block> blocks() const
+    {
+        return _blocks;
+    }
+
+    /**
+     * @brief What the log is written in
+     */
+    [[nodiscard]] OutputFormat format() const
+    {
+        return static_cast<OutputFormat>(
+                reinterpret_cast<const index::Header *>(_file.view().data())->format);
+    }
+
+    /**
+     * @brief Where the indexed part of the log ends
+     */
+    [[nodiscard]] uint64_t indexedSize() const
+    {
+        if (_blocks.empty()) return 0;
+        return _blocks.back().offset + _blocks.back().size;
+    }
+
+private:
+    MappedFile _file;
+    std::span<const index::Block> _blocks;
+};
+
+/**
+ * @brief Format of the log, from its index, or guessed if there's no usable one
+ */
+inline OutputFormat logFormat(const std::string &log_path, std::string_view log)
+{
+    try {
+        return IndexReader(log_path).format();
+    } catch (const std::exception &) {
+        return index::guessFormat(log);
+    }
+}
+
+} // namespace mmd
+
+#endif // LOGINDEX_HPP_
@@ -0,0 +1,379 @@
+/**
+ * @file LogRecord.hpp
+ * @brief Reading back the records written by mmdsrv, in any of its output formats
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef LOGRECORD_HPP_
+#define LOGRECORD_HPP_
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "OutputEncoder.hpp" // for OutputFormat
+
+namespace mmd {
+
+/**
+ * @brief One record of the log, split into fields
+ * All views point into the log itself, data is still encoded as written:
+ * hex for "bin" records, and with the escapes of the format if escaped is set.
+ */
+struct LogRecord
+{
+    size_t timestamp;
+    std::string_view addr;
+    std::string_view type;
+    std::string_view data;
+    OutputFormat format{ OutputFormat::Plain };
+    bool escaped{ false }; // data has to go through unescapeData to get the payload back
+};
+
+namespace detail {
+
+/**
+ * @brief Parses the whole of text as a timestamp
+ */
+inline bool parseTimestamp(std::string_view text, size_t &out)
+{
+    const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+    return ec == std::errc{} && ptr == text.data() + text.size() && !text.empty();
+}
+
+/**
+ * @brief Takes what's before the separator off the front of rec, and the separator too
+ */
+inline bool takeUntil(std::string_view &rec, std::string_view separator, std::string_view &out)
+{
+    const auto end = rec.find(separator);
+    if (end == std::string_view::npos) return false;
+    out = rec.substr(0, end);
+    rec.remove_prefix(end + separator.size());
+    return true;
+}
+
+/**
+ * @brief Takes prefix off the front of rec, if it's there
+ */
+inline bool skip(std::string_view &rec, std::string_view prefix)
+{
+    if (!rec.starts_with(prefix)) return false;
+    rec.remove_prefix(prefix.size());
+    return true;
+}
+
+} // namespace detail
+
+/**
+ * @brief Reads records back in the given format, specialized for each of them,
+ * the other way round from Encoder.
+ * Each specialization has:
+ * - parse(), splits one record, without its trailing newline, into fields;
+ * - end(), where the first record of the text ends, i.e. its trailing newline;
+ * - unescape(), the payload of an escaped text record, never longer than the data.
+ */
+template<OutputFormat Format>
+struct Decoder;
+
+template<>
+struct Decoder<OutputFormat::Plain>
+{
+    /**
+     * @brief Parses "ts;{};addr;{};type;{};data;{}"
+     */
+    static std::optional<LogRecord> parse(std::string_view rec)
+    {
+        LogRecord result{};
+
+        std::string_view ts;
+        if (!detail::skip(rec, "ts;") || !detail::takeUntil(rec, ";", ts)) return std::nullopt;
+        if (!detail::parseTimestamp(ts, result.timestamp)) return std::nullopt;
+        if (!detail::skip(rec, "addr;") || !detail::takeUntil(rec, ";", result.addr)) {
+            return std::nullopt;
+        }
+        if (!detail::skip(rec, "type;") || !detail::takeUntil(rec, ";", result.type)) {
+            return std::nullopt;
+        }
+
+        // data is the rest, it may well contain ';'
+        if (!detail::skip(rec, "data;")) return std::nullopt;
+        result.data = rec;
+        return result;
+    }
+
+    /**
+     * @brief Records may contain newlines in their data,
+     * so a record ends only where the next line starts with "ts;".
+     */
+    static size_t end(std::string_view text)
+    {
+        return text.find("\nts;");
+    }
+
+    static std::optional<size_t> unescape(std::string_view data, char *out)
+    {
+        std::copy(data.begin(), data.end(), out);
+        return data.size();
+    }
+};
+
+template<>
+struct Decoder<OutputFormat::Csv>
+{
+    /**
+     * @brief Parses "ts,addr,type,data", with data quoted if it had to be
+     */
+    static std::optional<LogRecord> parse(std::string_view rec)
+    {
+        LogRecord result{};
+        result.format = OutputFormat::Csv;
+
+        std::string_view ts;
+        if (!detail::takeUntil(rec, ",", ts) || !detail::parseTimestamp(ts, result.timestamp)) {
+            return std::nullopt;
+        }
+        if (!detail::takeUntil(rec, ",", result.addr)) return std::nullopt;
+        if (!detail::takeUntil(rec, ",", result.type)) return std::nullopt;
+
+        if (rec.starts_with('"')) {
+            if (rec.size() < 2 || !rec.ends_with('"')) return std::nullopt;
+            rec = rec.substr(1, rec.size() - 2);
+            result.escaped = true;
+        }
+        result.data = rec;
+        return result;
+    }
+
+    /**
+     * @brief One record per line, except for newlines inside the quotes.
+     * Only data is ever quoted, and '"' never appears outside of quotes,
+     * so every '"' flips in and out of them, doubled ones included.
+     */
+    static size_t end(std::string_view text)
+    {
+        bool quoted{ false };
+        for (size_t pos{ 0 };; ++pos) {
+            pos = text.find_first_of(quoted ? "\"" : "\"\n", pos);
+            if (pos == std::string_view::npos || text[pos] == '\n') return pos;
+            quoted = !quoted;
+        }
+    }
+
+    /**
+     * @brief Inside the quotes, only '"' is escaped, by doubling it
+     */
+    static std::optional<size_t> unescape(std::string_view data, char *out)
+    {
+        size_t size{ 0 };
+        for (size_t pos{ 0 }; pos < data.size(); ++pos) {
+            if (data[pos] == '"' && (pos + 1 == data.size() || data[++pos] != '"')) {
+                return std::nullopt;
+            }
+            out[size++] = data[pos];
+        }
+        return size;
+    }
+};
+
+template<>
+struct Decoder<OutputFormat::Json>
+{
+    /**
+     * @brief Parses {"ts":{},"addr":"{}","type":"{}","data":"{}"}, the way Encoder writes it
+     */
+    static std::optional<LogRecord> parse(std::string_view rec)
+    {
+        LogRecord result{};
+        result.format = OutputFormat::Json;
+
+        std::string_view ts;
+        if (!detail::skip(rec, R"({"ts":)") || !detail::takeUntil(rec, ",", ts)
+            || !detail::parseTimestamp(ts, result.timestamp)) {
+            return std::nullopt;
+        }
+        if (!detail::skip(rec, R"("addr":")") || !detail::takeUntil(rec, R"(",)", result.addr)) {
+            return std::nullopt;
+        }
+        if (!detail::skip(rec, R"("type":")") || !detail::takeUntil(rec, R"(",)", result.type)) {
+            return std::nullopt;
+        }
+
+        // data is the rest, up to the closing "}
+        if (!detail::skip(rec, R"("data":")") || !rec.ends_with(R"("})")) return std::nullopt;
+        result.data = rec.substr(0, rec.size() - 2);
+        result.escaped = result.data.find('\\') != std::string_view::npos;
+        return result;
+    }
+
+    /**
+     * @brief Exactly one record per line, newlines in the data are escaped
+     */
+    static size_t end(std::string_view text)
+    {
+        return text.find('\n');
+    }
+
+    /**
+     * @brief Undoes the JSON string escapes, \\uXXXX goes out as UTF-8
+     */
+    static std::optional<size_t> unescape(std::string_view data, char *out)
+    {
+        size_t size{ 0 };
+        for (size_t pos{ 0 }; pos < data.size(); ++pos) {
+            if (data[pos] != '\\') {
+                out[size++] = data[pos];
+                continue;
+            }
+            if (++pos == data.size()) return std::nullopt;
+            switch (data[pos]) {
+            case '"': out[size++] = '"'; break;
+            case '\\': out[size++] = '\\'; break;
+            case '/': out[size++] = '/'; break;
+            case 'b': out[size++] = '\b'; break;
+            case 'f': out[size++] = '\f'; break;
+            case 'n': out[size++] = '\n'; break;
+            case 'r': out[size++] = '\r'; break;
+            case 't': out[size++] = '\t'; break;
+            case 'u': {
+                const auto hex = data.substr(pos + 1, 4);
+                uint32_t code{ 0 };
+                const auto [ptr, ec] =
+                        std::from_chars(hex.data(), hex.data() + hex.size(), code, 16);
+                if (hex.size() != 4 || ec != std::errc{} || ptr != hex.data() + hex.size()) {
+                    return std::nullopt;
+                }
+                if (code >= 0xd800 && code <= 0xdfff) return std::nullopt; // no surrogates
+                pos += 4;
+                if (code < 0x80) {
+                    out[size++] = static_cast<char>(code);
+                } else if (code < 0x800) {
+                    out[size++] = static_cast<char>(0xc0 | (code >> 6));
+                    out[size++] = static_cast<char>(0x80 | (code & 0x3f));
+                } else {
+                    out[size++] = static_cast<char>(0xe0 | (code >> 12));
+                    out[size++] = static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                    out[size++] = static_cast<char>(0x80 | (code & 0x3f));
+                }
+                break;
+            }
+            default: return std::nullopt;
+            }
+        }
+        return size;
+    }
+};
+
+/**
+ * @brief Parses one record of the log, without the trailing newline
+ * @return std::nullopt if the record doesn't look like one of ours
+ */
+inline std::optional<LogRecord> parseRecord(std::string_view rec,
+                                            OutputFormat format = OutputFormat::Plain)
+{
+    switch (format) {
+    case OutputFormat::Plain: return Decoder<OutputFormat::Plain>::parse(rec);
+    case OutputFormat::Csv: return Decoder<OutputFormat::Csv>::parse(rec);
+    case OutputFormat::Json: return Decoder<OutputFormat::Json>::parse(rec);
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Gets the payload of a text record back, as it was received
+ * @param out Where to put it, at least rec.data.size() long
+ * @return Number of bytes, or std::nullopt if the escapes are broken
+ */
+inline std::optional<size_t> unescapeData(const LogRecord &rec, char *out)
+{
+    if (!rec.escaped) return Decoder<OutputFormat::Plain>::unescape(rec.data, out);
+    switch (rec.format) {
+    case OutputFormat::Plain: return Decoder<OutputFormat::Plain>::unescape(rec.data, out);
+    case OutputFormat::Csv: return Decoder<OutputFormat::Csv>::unescape(rec.data, out);
+    case OutputFormat::Json: return Decoder<OutputFormat::Json>::unescape(rec.data, out);
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Decodes data of "bin" records back into bytes
+ * @param hex Two lowercase or uppercase hex digits per byte
+ * @param out Where to put the bytes, at least hex.size() / 2 long
+ * @return Number of bytes decoded, or std::nullopt if hex is not hex
+ */
+inline std::optional<size_t> decodeHex(std::string_view hex, char *out)
+{
+    const auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+
+    if (hex.size() % 2) return std::nullopt;
+    for (size_t i{ 0 }; i < hex.size(); i += 2) {
+        const auto hi = nibble(hex[i]);
+        const auto lo = nibble(hex[i + 1]);
+        if (hi < 0 || lo < 0) return std::nullopt;
+        out[i / 2] = static_cast<char>((hi << 4) | lo);
+    }
+    return hex.size() / 2;
+}
+
+/**
+ * @brief Walks over the records in a chunk of the log
+ * Where a record ends depends on the format, see Decoder::end.
+ * The chunk is expected to start at the beginning of a record.
+ */
+class RecordCursor
+{
+public:
+    RecordCursor(std::string_view chunk, OutputFormat format = OutputFormat::Plain)
+        : _rest{ chunk }
+        , _format{ format }
+    {
+    }
+
+    /**
+     * @brief Returns the next record without the trailing newline
+     * @return std::nullopt when the chunk is over
+     */
+    std::optional<std::string_view> next()
+    {
+        if (_rest.empty()) return std::nullopt;
+        auto end = recordEnd();
+        std::string_view rec;
+        if (end == std::string_view::npos) {
+            rec = _rest;
+            if (rec.ends_with('\n')) rec.remove_suffix(1);
+            _rest = {};
+        } else {
+            rec = _rest.substr(0, end);
+            _rest.remove_prefix(end + 1);
+        }
+        return rec;
+    }
+
+private:
+    size_t recordEnd() const
+    {
+        switch (_format) {
+        case OutputFormat::Plain: return Decoder<OutputFormat::Plain>::end(_rest);
+        case OutputFormat::Csv: return Decoder<OutputFormat::Csv>::end(_rest);
+        case OutputFormat::Json: return Decoder<OutputFormat::Json>::end(_rest);
+        }
+        return std::string_view::npos;
+    }
+
+    std::string_view _rest;
+    OutputFormat _format;
+};
+
+} // namespace mmd
+
+#endif // LOGRECORD_HPP_
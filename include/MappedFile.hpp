@@ -0,0 +1,89 @@
+/**
+ * @file MappedFile.hpp
+ * @brief Contains implementation of MappedFile class.
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef MAPPEDFILE_HPP_
+#define MAPPEDFILE_HPP_
+
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace mmd {
+
+/**
+ * @brief RAII read-only memory mapping of a whole file.
+ * Same deal as FileDataWriter, throws on errors.
+ * Empty files are fine and give an empty view.
+ */
+class MappedFile
+{
+public:
+    MappedFile(const std::string &file_path)
+    {
+        _fd = ::open(file_path.c_str(), O_RDONLY);
+        if (_fd == -1) {
+            throw std::system_error(errno, std::generic_category(), "Failed to open file");
+        }
+        struct stat st
+        {
+        };
+        if (::fstat(_fd, &st) == -1) {
+            const auto err = errno;
+            ::close(_fd);
+            throw std::system_error(err, std::generic_category(), "Failed to stat file");
+        }
+        _size = static_cast<size_t>(st.st_size);
+        if (_size > 0) {
+            _data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+            if (_data == MAP_FAILED) {
+                const auto err = errno;
+                ::close(_fd);
+                throw std::system_error(err, std::generic_category(), "Failed to map file");
+            }
+            // mostly read front to back, let the kernel read ahead
+            ::madvise(_data, _size, MADV_SEQUENTIAL);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        if (_data != MAP_FAILED) {
+            ::munmap(_data, _size);
+        }
+        if (_fd != -1) {
+            ::close(_fd);
+        }
+    }
+
+    [[nodiscard]] std::string_view view() const
+    {
+        if (_data == MAP_FAILED) return {};
+        return { static_cast<const char *>(_data), _size };
+    }
+
+    [[nodiscard]] size_t size() const
+    {
+        return _size;
+    }
+
+private:
+    int _fd{ -1 }; // File descriptor
+    void *_data{ MAP_FAILED };
+    size_t _size{ 0 };
+};
+} // namespace mmd
+
+#endif // MAPPEDFILE_HPP_
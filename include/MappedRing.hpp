@@ -0,0 +1,151 @@
+/**
+ * @file MappedRing.hpp
+ * @brief Contains the record layout and memory mapping shared by the rings in mapped memory.
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef MAPPEDRING_HPP_
+#define MAPPEDRING_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace mmd {
+namespace ring {
+
+enum class RecordKind : uint16_t {
+    Pad, // filler up to the end of the ring, skip it
+    Formatted, // data is a line of the log
+    Raw, // data is the payload as received
+};
+
+/**
+ * @brief Precedes each record, followed by addr and then data, padded to 8 bytes
+ * Records never wrap around the end of the ring, the rest of it is filled with a Pad
+ * record, or just skipped when there's no room even for the header of one.
+ */
+struct RecordHeader
+{
+    uint64_t seq;
+    uint64_t timestamp;
+    uint32_t size; // whole record, with this header and the padding
+    uint32_t datasize;
+    uint16_t addrsize;
+    RecordKind kind;
+};
+
+inline constexpr size_t align(size_t size)
+{
+    return (size + 7) & ~size_t{ 7 };
+}
+
+/**
+ * @brief Bytes of filler needed at pos before a record of size bytes
+ * @param capacity Of the ring, power of two
+ */
+inline constexpr size_t padding(uint64_t pos, size_t capacity, size_t size)
+{
+    const auto room = capacity - (pos & (capacity - 1));
+    return room < size ? room : 0;
+}
+
+/**
+ * @brief Bytes at pos that are too few for a header, and so hold nothing; 0 if that's not the case
+ */
+inline constexpr size_t tail(uint64_t pos, size_t capacity)
+{
+    const auto room = capacity - (pos & (capacity - 1));
+    return room < sizeof(RecordHeader) ? room : 0;
+}
+
+/**
+ * @brief Writes a Pad record of pad bytes at pos, if there's room for its header
+ */
+inline void writePad(char *data, size_t capacity, uint64_t pos, size_t pad, uint64_t seq)
+{
+    if (pad < sizeof(RecordHeader)) return;
+    const RecordHeader filler{ seq, 0, static_cast<uint32_t>(pad), 0, 0, RecordKind::Pad };
+    std::memcpy(data + (pos & (capacity - 1)), &filler, sizeof(filler));
+}
+
+/**
+ * @brief Writes a whole record at pos, sizes in the header are filled in from addr and body
+ * @return Size of the record, which is how far pos moves
+ */
+inline size_t writeRecord(char *data, size_t capacity, uint64_t pos, uint64_t seq,
+                          uint64_t timestamp, RecordKind kind, std::string_view addr,
+                          std::string_view body)
+{
+    const auto size = align(sizeof(RecordHeader) + addr.size() + body.size());
+    const RecordHeader header{ seq,
+                               timestamp,
+                               static_cast<uint32_t>(size),
+                               static_cast<uint32_t>(body.size()),
+                               static_cast<uint16_t>(addr.size()),
+                               kind };
+    char *out = data + (pos & (capacity - 1));
+    std::memcpy(out, &header, sizeof(header));
+    std::memcpy(out + sizeof(header), addr.data(), addr.size());
+    std::memcpy(out + sizeof(header) + addr.size(), body.data(), body.size());
+    return size;
+}
+
+/**
+ * @brief RAII read-write shared mapping of a whole file, the file is allocated up front.
+ * Sparse files are not good enough here: a write into a page the file system has no room
+ * for is SIGBUS, so running out of space is an exception from the constructor instead.
+ */
+class SharedMapping
+{
+public:
+    /**
+     * @param fd Closed when done, the mapping keeps the file alive
+     * @param what What it is, for the error messages
+     */
+    SharedMapping(int fd, size_t size, const std::string &what)
+        : _size{ size }
+    {
+        if (const auto err = ::posix_fallocate(fd, 0, static_cast<off_t>(size)); err != 0) {
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "Failed to size " + what);
+        }
+        void *memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        const auto err = errno;
+        ::close(fd);
+        if (memory == MAP_FAILED) {
+            throw std::system_error(err, std::generic_category(), "Failed to map " + what);
+        }
+        _data = static_cast<char *>(memory);
+    }
+
+    SharedMapping(const SharedMapping &) = delete;
+    SharedMapping &operator=(const SharedMapping &) = delete;
+
+    ~SharedMapping()
+    {
+        ::munmap(_data, _size);
+    }
+
+    [[nodiscard]] char *data() const
+    {
+        return _data;
+    }
+
+private:
+    char *_data;
+    size_t _size;
+};
+
+} // namespace ring
+} // namespace mmd
+
+#endif // MAPPEDRING_HPP_
@@ -0,0 +1,312 @@
+/**
+ * @file OutputEncoder.hpp
+ * @brief Contains encoders for the output formats of the log: plain, CSV and JSON lines.
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef OUTPUTENCODER_HPP_
+#define OUTPUTENCODER_HPP_
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <fmt/compile.h>
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+
+#include "Common.hpp"
+
+namespace mmd {
+
+enum class DataType {
+    Ascii,
+    Utf8,
+    Binary,
+};
+
+enum class OutputFormat {
+    Plain, // ts;{};addr;{};type;{};data;{}, payload as is
+    Csv, // ts,addr,type,data with data quoted when needed, RFC 4180
+    Json, // one object per line
+};
+
+inline constexpr std::string_view formatName(OutputFormat format)
+{
+    switch (format) {
+    case OutputFormat::Plain: return "plain";
+    case OutputFormat::Csv: return "csv";
+    case OutputFormat::Json: return "json";
+    }
+    return "";
+}
+
+inline constexpr std::string_view typeName(DataType type)
+{
+    switch (type) {
+    case DataType::Ascii: return "ascii";
+    case DataType::Utf8: return "utf8";
+    case DataType::Binary: return "bin";
+    }
+    return "";
+}
+
+/**
+ * @brief Payload bytes for "{:02x}", unsigned so that the sign of char doesn't matter
+ */
+inline auto hexBytes(const char *payload, size_t size)
+{
+    return fmt::join(std::span(reinterpret_cast<const unsigned char *>(payload), size), "");
+}
+
+namespace escape {
+
+/**
+ * @brief Whether the byte can't go into the output as is
+ */
+template<OutputFormat Format>
+constexpr bool needed(char c)
+{
+    if constexpr (Format == OutputFormat::Csv) {
+        return c == '"' || c == ',' || c == '\n' || c == '\r';
+    } else if constexpr (Format == OutputFormat::Json) {
+        return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+    } else {
+        return false;
+    }
+}
+
+#if defined(__SSE2__)
+/**
+ * @brief Same as needed(), for 16 bytes at once, a bit per byte
+ */
+template<OutputFormat Format>
+inline unsigned neededMask(__m128i chunk)
+{
+    const auto is = [chunk](char c) {
+        return _mm_cmpeq_epi8(chunk, _mm_set1_epi8(c));
+    };
+    __m128i found = _mm_setzero_si128();
+    if constexpr (Format == OutputFormat::Csv) {
+        found = _mm_or_si128(_mm_or_si128(is('"'), is(',')), _mm_or_si128(is('\n'), is('\r')));
+    } else if constexpr (Format == OutputFormat::Json) {
+        // unsigned c <= 0x1f is max(c, 0x1f) == 0x1f
+        const auto control = _mm_set1_epi8(0x1f);
+        found = _mm_or_si128(_mm_or_si128(is('"'), is('\\')),
+                             _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+    }
+    return static_cast<unsigned>(_mm_movemask_epi8(found));
+}
+#endif
+
+/**
+ * @brief Finds the first byte that needs escaping, 16 bytes at a time where there's SSE2
+ * @return Its position, or size if there's none
+ */
+template<OutputFormat Format>
+inline size_t find(const char *data, size_t size)
+{
+    size_t i{ 0 };
+#if defined(__SSE2__)
+    for (; i + 16 <= size; i += 16) {
+        const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        if (const auto mask = neededMask<Format>(chunk); mask) {
+            return i + static_cast<size_t>(std::countr_zero(mask));
+        }
+    }
+#endif
+    for (; i < size; ++i) {
+        if (needed<Format>(data[i])) return i;
+    }
+    return size;
+}
+
+} // namespace escape
+
+/**
+ * @brief Writes a whole record in the given format, specialized for each of them.
+ * Each specialization has:
+ * - textSize(), exact size of the encoded text payload, without the rest of the record;
+ * - textPrefix(), longest prefix of the text payload whose textSize() is at most limit;
+ * - write(), the record itself, binary payloads are hex encoded.
+ */
+template<OutputFormat Format>
+struct Encoder;
+
+template<>
+struct Encoder<OutputFormat::Plain>
+{
+    static size_t textSize(const char *, size_t size)
+    {
+        return size;
+    }
+
+    static size_t textPrefix(const char *, size_t size, size_t limit)
+    {
+        return std::min(size, limit);
+    }
+
+    static char *write(char *out, const ReceivedData &rdata, DataType type, const char *payload,
+                       size_t size)
+    {
+        const std::string_view addr{ rdata.addr, rdata.addrsize };
+        if (type == DataType::Binary) {
+            return fmt::format_to(out, FMT_COMPILE("ts;{};addr;{};type;bin;data;{:02x}\n"),
+                                  rdata.timestamp, addr, hexBytes(payload, size));
+        }
+        return fmt::format_to(out, FMT_COMPILE("ts;{};addr;{};type;{};data;{:s}\n"),
+                              rdata.timestamp, addr, typeName(type), std::span(payload, size));
+    }
+};
+
+template<>
+struct Encoder<OutputFormat::Csv>
+{
+    static size_t textSize(const char *payload, size_t size)
+    {
+        if (escape::find<OutputFormat::Csv>(payload, size) == size) return size;
+        size_t quotes{ 0 };
+        for (const char *p = payload, *end = payload + size;
+             (p = static_cast<const char *>(std::memchr(p, '"', end - p))); ++p) {
+            quotes++;
+        }
+        return size + quotes + 2;
+    }
+
+    static size_t textPrefix(const char *payload, size_t size, size_t limit)
+    {
+        const auto first = escape::find<OutputFormat::Csv>(payload, size);
+        if (first >= limit || first == size) return std::min(size, limit);
+        // from the first byte that needs it on, the prefix is quoted and '"' doubles
+        size_t text{ first + 2 };
+        size_t prefix{ first };
+        for (; prefix < size; ++prefix) {
+            text += payload[prefix] == '"' ? 2 : 1;
+            if (text > limit) break;
+        }
+        return prefix;
+    }
+
+    static char *write(char *out, const ReceivedData &rdata, DataType type, const char *payload,
+                       size_t size)
+    {
+        out = fmt::format_to(out, FMT_COMPILE("{},{},{},"), rdata.timestamp,
+                             std::string_view(rdata.addr, rdata.addrsize), typeName(type));
+        if (type == DataType::Binary) {
+            out = fmt::format_to(out, FMT_COMPILE("{:02x}"), hexBytes(payload, size));
+        } else if (escape::find<OutputFormat::Csv>(payload, size) == size) {
+            out = std::copy_n(payload, size, out);
+        } else {
+            // quoted, and only quotes need doubling in there
+            *out++ = '"';
+            const char *end = payload + size;
+            for (const char *p = payload; p < end;) {
+                const auto *quote = static_cast<const char *>(std::memchr(p, '"', end - p));
+                const char *run_end = quote ? quote + 1 : end;
+                out = std::copy(p, run_end, out);
+                if (quote) *out++ = '"';
+                p = run_end;
+            }
+            *out++ = '"';
+        }
+        *out++ = '\n';
+        return out;
+    }
+};
+
+template<>
+struct Encoder<OutputFormat::Json>
+{
+    static size_t textSize(const char *payload, size_t size)
+    {
+        size_t result{ size };
+        for (size_t pos{ escape::find<OutputFormat::Json>(payload, size) }; pos < size;
+             pos += 1 + escape::find<OutputFormat::Json>(payload + pos + 1, size - pos - 1)) {
+            result += shortForm(payload[pos]) ? 1 : 5;
+        }
+        return result;
+    }
+
+    static size_t textPrefix(const char *payload, size_t size, size_t limit)
+    {
+        size_t text{ 0 };
+        for (size_t pos{ 0 }; pos < size; ++pos) {
+            const auto run = escape::find<OutputFormat::Json>(payload + pos, size - pos);
+            if (text + run >= limit) return pos + (limit - text);
+            text += run;
+            pos += run;
+            if (pos == size) break;
+            // \X, or \u00XX for control characters
+            text += shortForm(payload[pos]) ? 2 : 6;
+            if (text > limit) return pos;
+        }
+        return size;
+    }
+
+    static char *write(char *out, const ReceivedData &rdata, DataType type, const char *payload,
+                       size_t size)
+    {
+        out = fmt::format_to(out,
+                             FMT_COMPILE("{{\"ts\":{},\"addr\":\"{}\",\"type\":\"{}\","
+                                         "\"data\":\""),
+                             rdata.timestamp, std::string_view(rdata.addr, rdata.addrsize),
+                             typeName(type));
+        if (type == DataType::Binary) {
+            out = fmt::format_to(out, FMT_COMPILE("{:02x}"), hexBytes(payload, size));
+        } else {
+            // copy the runs between the escapes as they are, most payloads are a single run
+            for (size_t pos{ 0 }; pos < size;) {
+                const auto run = escape::find<OutputFormat::Json>(payload + pos, size - pos);
+                out = std::copy_n(payload + pos, run, out);
+                pos += run;
+                if (pos == size) break;
+                out = escaped(out, payload[pos++]);
+            }
+        }
+        std::memcpy(out, "\"}\n", 3);
+        return out + 3;
+    }
+
+private:
+    static constexpr char shortForm(char c)
+    {
+        switch (c) {
+        case '"': return '"';
+        case '\\': return '\\';
+        case '\b': return 'b';
+        case '\f': return 'f';
+        case '\n': return 'n';
+        case '\r': return 'r';
+        case '\t': return 't';
+        default: return 0;
+        }
+    }
+
+    static char *escaped(char *out, char c)
+    {
+        static constexpr char hex[] = "0123456789abcdef";
+        *out++ = '\\';
+        if (const auto s = shortForm(c); s) {
+            *out++ = s;
+            return out;
+        }
+        const auto u = static_cast<unsigned char>(c);
+        std::memcpy(out, "u00", 3);
+        out[3] = hex[u >> 4];
+        out[4] = hex[u & 0xf];
+        return out + 5;
+    }
+};
+
+} // namespace mmd
+
+#endif // OUTPUTENCODER_HPP_
@@ -12,8 +12,13 @@
 
 #include <cxxopts.hpp>
 #include <filesystem>
+#include <limits>
+#include <stdexcept>
 #include <string>
 
+#include "AdmissionQueue.hpp" // for AdmissionSettings
+#include "OutputEncoder.hpp" // for OutputFormat
+
 namespace mmd {
 /**
  * @brief Parses params from command line
@@ -34,7 +39,16 @@ public:
         ("a,address", "Set server address, IPv4 or IPv6", cxxopts::value<std::string>()->default_value("0.0.0.0"))
         ("p,port",    "Set server port", cxxopts::value<uint16_t>()->default_value("7768"))
         ("f,filter",  "Set filter string", cxxopts::value<std::string>()->default_value("*"))
-        ("o,output",  "Set output file name", cxxopts::value<std::string>()->default_value("./mmdsrv.log"));
+        ("o,output",  "Set output file name", cxxopts::value<std::string>()->default_value("./mmdsrv.log"))
+        ("format",    "Set output format, plain, csv or json", cxxopts::value<std::string>()->default_value("plain"))
+        ("shm",       "Also publish records to this shared memory ring, like /mmdsrv", cxxopts::value<std::string>()->default_value(""))
+        ("shm-raw",   "Publish payloads as received instead of formatted records")
+        ("spill",     "Set size of the spill file for bursts, MiB, 0 for none", cxxopts::value<size_t>()->default_value(std::to_string(config::spill_size_mb)))
+        ("m,mode",    "Set pipeline mode, threads or coro (single thread)", cxxopts::value<std::string>()->default_value("threads"))
+        ("r,rate",    "Set per-source rate limit, packets/s, 0 for none", cxxopts::value<uint64_t>()->default_value(std::to_string(config::source_rate)))
+        ("b,burst",   "Set per-source burst size, packets", cxxopts::value<uint64_t>()->default_value(std::to_string(config::source_burst)))
+        ("s,sample",  "Set 1-in-N sampling under load, 0 for none", cxxopts::value<uint64_t>()->default_value(std::to_string(config::sample_step)))
+        ("quiet",     "Set rate below which sources aren't sampled, packets/s, 0 for none", cxxopts::value<uint64_t>()->default_value(std::to_string(config::quiet_rate)));
         // clang-format on
 
         params = options.parse(argc, argv);
@@ -43,6 +57,38 @@ public:
         _port = params["port"].as<uint16_t>();
         _filter = params["filter"].as<std::string>();
         _filename = fs::absolute(params["output"].as<std::string>()).string();
+        const auto format = params["format"].as<std::string>();
+        if (format == "plain") {
+            _outputFormat = OutputFormat::Plain;
+        } else if (format == "csv") {
+            _outputFormat = OutputFormat::Csv;
+        } else if (format == "json") {
+            _outputFormat = OutputFormat::Json;
+        } else {
+            throw std::runtime_error("Unknown format " + format + ", expected plain, csv or json");
+        }
+        const auto mode = params["mode"].as<std::string>();
+        if (mode != "threads" && mode != "coro") {
+            throw std::runtime_error("Unknown mode " + mode + ", expected threads or coro");
+        }
+        _singleThread = mode == "coro";
+        _shmName = params["shm"].as<std::string>();
+        _shmRaw = params.count("shm-raw") > 0;
+        _spillSize = params["spill"].as<size_t>() * 1024 * 1024;
+        _admission.rate = params["rate"].as<uint64_t>();
+        _admission.burst = params["burst"].as<uint64_t>();
+        _admission.sample = params["sample"].as<uint64_t>();
+        _admission.quiet = params["quiet"].as<uint64_t>();
+        if (_admission.rate && !_admission.burst) {
+            throw std::runtime_error("Burst of 0 with a rate limit would drop everything");
+        }
+        // tokens are kept in billionths of a packet, see AdmissionQueue
+        if (_admission.burst > std::numeric_limits<uint64_t>::max() / 1'000'000'000) {
+            throw std::runtime_error("Burst of " + std::to_string(_admission.burst)
+                                     + " is too large, max is "
+                                     + std::to_string(std::numeric_limits<uint64_t>::max()
+                                                      / 1'000'000'000));
+        }
         _requestedHelp = params.count("help") > 0;
         _help = options.help();
     };
@@ -63,6 +109,30 @@ public:
     {
         return _filename;
     }
+    [[nodiscard]] OutputFormat outputFormat() const
+    {
+        return _outputFormat;
+    }
+    [[nodiscard]] bool singleThread() const
+    {
+        return _singleThread;
+    }
+    [[nodiscard]] std::string shmName() const
+    {
+        return _shmName;
+    }
+    [[nodiscard]] bool shmRaw() const
+    {
+        return _shmRaw;
+    }
+    [[nodiscard]] size_t spillSize() const
+    {
+        return _spillSize;
+    }
+    [[nodiscard]] AdmissionSettings admission() const
+    {
+        return _admission;
+    }
     [[nodiscard]] bool requestedHelp() const
     {
         return _requestedHelp;
@@ -77,6 +147,12 @@ private:
     uint16_t _port;
     std::string _filter;
     std::string _filename;
+    OutputFormat _outputFormat;
+    bool _singleThread;
+    std::string _shmName;
+    bool _shmRaw;
+    size_t _spillSize;
+    AdmissionSettings _admission;
     std::string _help;
     bool _requestedHelp;
 };
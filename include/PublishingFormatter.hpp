@@ -0,0 +1,67 @@
+/**
+ * @file PublishingFormatter.hpp
+ * @brief Formatter decorator that also publishes records to the shared memory ring
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef PUBLISHINGFORMATTER_HPP_
+#define PUBLISHINGFORMATTER_HPP_
+
+#include <functional>
+
+#include "Common.hpp"
+#include "FormatWorker.hpp" // for Formatter concept
+#include "ShmRing.hpp"
+
+namespace mmd {
+
+/**
+ * @brief Wraps a Formatter and puts every record into a ShmRingWriter on the way.
+ * Formatting happens in one thread in both pipeline modes,
+ * so this is where the ring gets its single writer for free,
+ * and local consumers see the record before it even gets to the file.
+ *
+ * @tparam FormatterT Something that implements the Formatter concept.
+ */
+template<Formatter FormatterT>
+class PublishingFormatter
+{
+public:
+    /**
+     * @param raw Publish the payload as received instead of the formatted line
+     */
+    PublishingFormatter(FormatterT &formatter, ShmRingWriter &ring, bool raw = false)
+        : _formatter{ formatter }
+        , _ring{ ring }
+        , _raw{ raw }
+    {
+    }
+
+    FormattedData format(const ReceivedData &rdata)
+    {
+        auto fdata = _formatter.get().format(rdata);
+        const std::string_view addr{ rdata.addr, rdata.addrsize };
+        bool published{ true };
+        if (_raw) {
+            published = _ring.get().publish(shm::RecordKind::Raw, rdata.timestamp, addr,
+                                            { rdata.payload(), rdata.datasize });
+        } else if (fdata.datasize > 0) {
+            published = _ring.get().publish(shm::RecordKind::Formatted, rdata.timestamp, addr,
+                                             fdata.view());
+        }
+        if (!published) stats::unpublished.fetch_add(1, std::memory_order::relaxed);
+        return fdata;
+    }
+
+private:
+    std::reference_wrapper<FormatterT> _formatter;
+    std::reference_wrapper<ShmRingWriter> _ring;
+    bool _raw;
+};
+
+} // namespace mmd
+
+#endif // PUBLISHINGFORMATTER_HPP_
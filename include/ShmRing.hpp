@@ -0,0 +1,300 @@
+/**
+ * @file ShmRing.hpp
+ * @brief Contains implementation of a shared memory ring for local consumers of the records.
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef SHMRING_HPP_
+#define SHMRING_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+#include "MappedRing.hpp"
+
+namespace mmd {
+namespace shm {
+
+static constexpr char magic[8] = { 'M', 'M', 'D', 'R', 'I', 'N', 'G', '1' };
+
+/**
+ * @brief Start of the shared memory, data follows right after it
+ * Positions only ever grow, offset in data is position % capacity.
+ * The writer moves reserve before touching the data and commit after,
+ * so readers can tell if what they have just read was being overwritten.
+ */
+struct RingHeader
+{
+    char magic[8];
+    uint64_t capacity; // bytes of data, power of two
+    alignas(64) std::atomic<uint64_t> reserve;
+    alignas(64) std::atomic<uint64_t> commit;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "positions are shared between processes, they can't have a lock");
+
+// records are laid out in the data the same way as in the spill file
+using RecordKind = ring::RecordKind;
+using RecordHeader = ring::RecordHeader;
+
+/**
+ * @brief What a reader gets, views point right into the shared memory
+ */
+struct Record
+{
+    uint64_t seq;
+    uint64_t timestamp;
+    RecordKind kind;
+    std::string_view addr;
+    std::string_view data;
+};
+
+enum class ReadResult {
+    Record, // got one
+    Empty, // nothing new
+    Overrun, // writer lapped us, whatever we were reading is gone, cursor moved to the newest
+};
+
+inline constexpr size_t dataOffset()
+{
+    return (sizeof(RingHeader) + 63) & ~size_t{ 63 };
+}
+
+} // namespace shm
+
+/**
+ * @brief Single writer of a named shared memory ring.
+ * Never waits for readers: when the ring is full it just goes over the oldest records,
+ * readers find out about that themselves.
+ * Same RAII and exceptions deal as FileDataWriter; the name is unlinked on destruction,
+ * readers that have it mapped keep going until they let go.
+ */
+class ShmRingWriter
+{
+public:
+    /**
+     * @param name Shared memory name, like "/mmdsrv"
+     * @param capacity Bytes of data, rounded up to a power of two
+     */
+    ShmRingWriter(const std::string &name, size_t capacity)
+        : _name{ name }
+    {
+        _capacity = 4096;
+        while (_capacity < capacity) _capacity *= 2;
+        _size = shm::dataOffset() + _capacity;
+
+        const int fd = ::shm_open(_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            throw std::system_error(errno, std::generic_category(), "Failed to open shared memory");
+        }
+        try {
+            _mapping.emplace(fd, _size, "shared memory");
+        } catch (...) {
+            ::shm_unlink(_name.c_str());
+            throw;
+        }
+
+        _header = new (_mapping->data()) shm::RingHeader{};
+        _header->capacity = _capacity;
+        _header->reserve.store(0, std::memory_order::relaxed);
+        _header->commit.store(0, std::memory_order::relaxed);
+        // magic goes last, readers check it
+        std::atomic_thread_fence(std::memory_order::release);
+        std::memcpy(_header->magic, shm::magic, sizeof(shm::magic));
+        _data = _mapping->data() + shm::dataOffset();
+    }
+
+    ShmRingWriter(const ShmRingWriter &) = delete;
+    ShmRingWriter &operator=(const ShmRingWriter &) = delete;
+
+    ~ShmRingWriter()
+    {
+        ::shm_unlink(_name.c_str());
+    }
+
+    /**
+     * @brief Appends a record, overwriting the oldest ones if needed
+     * @return false if the record is too big for the ring and was dropped
+     */
+    bool publish(shm::RecordKind kind, uint64_t timestamp, std::string_view addr,
+                 std::string_view data)
+    {
+        const auto size = ring::align(sizeof(shm::RecordHeader) + addr.size() + data.size());
+        if (size > _capacity / 2) return false;
+
+        const auto pad = ring::padding(_pos, _capacity, size);
+        const auto end = _pos + pad + size;
+
+        _header->reserve.store(end, std::memory_order::relaxed);
+        std::atomic_thread_fence(std::memory_order::release);
+
+        ring::writePad(_data, _capacity, _pos, pad, _seq);
+        ring::writeRecord(_data, _capacity, _pos + pad, _seq++, timestamp, kind, addr, data);
+
+        _header->commit.store(end, std::memory_order::release);
+        _pos = end;
+        return true;
+    }
+
+private:
+    std::string _name;
+    size_t _capacity;
+    size_t _size;
+    std::optional<ring::SharedMapping> _mapping;
+    shm::RingHeader *_header;
+    char *_data;
+    uint64_t _pos{ 0 };
+    uint64_t _seq{ 0 };
+};
+
+/**
+ * @brief One of any number of readers of the ring, with its own cursor.
+ * Reads straight from the shared memory, no copies, so the record has to be
+ * handled inside read() and is only good if read() says so afterwards.
+ * Starts from the newest record, not from the oldest one still there.
+ */
+class ShmRingReader
+{
+public:
+    ShmRingReader(const std::string &name)
+    {
+        const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd == -1) {
+            throw std::system_error(errno, std::generic_category(), "Failed to open shared memory");
+        }
+        struct stat st
+        {
+        };
+        if (::fstat(fd, &st) == -1) {
+            const auto err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "Failed to stat shared memory");
+        }
+        _size = static_cast<size_t>(st.st_size);
+        if (_size < shm::dataOffset()) {
+            ::close(fd);
+            throw std::runtime_error("Shared memory is not an mmdsrv ring");
+        }
+        _memory = static_cast<const char *>(::mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0));
+        const auto err = errno;
+        ::close(fd);
+        if (_memory == MAP_FAILED) {
+            throw std::system_error(err, std::generic_category(), "Failed to map shared memory");
+        }
+
+        _header = reinterpret_cast<const shm::RingHeader *>(_memory);
+        if (std::memcmp(_header->magic, shm::magic, sizeof(shm::magic)) != 0
+            || shm::dataOffset() + _header->capacity > _size) {
+            ::munmap(const_cast<char *>(_memory), _size);
+            throw std::runtime_error("Shared memory is not an mmdsrv ring");
+        }
+        std::atomic_thread_fence(std::memory_order::acquire);
+        _capacity = _header->capacity;
+        _data = _memory + shm::dataOffset();
+        _cursor = _header->commit.load(std::memory_order::acquire);
+    }
+
+    ShmRingReader(const ShmRingReader &) = delete;
+    ShmRingReader &operator=(const ShmRingReader &) = delete;
+
+    ~ShmRingReader()
+    {
+        ::munmap(const_cast<char *>(_memory), _size);
+    }
+
+    /**
+     * @brief Hands the next record to on_record(const shm::Record &)
+     * @return shm::ReadResult::Record if on_record got a good record,
+     * shm::ReadResult::Overrun if what it got (if anything) was overwritten meanwhile
+     */
+    template<typename F>
+    shm::ReadResult read(F &&on_record)
+    {
+        for (;;) {
+            const auto commit = _header->commit.load(std::memory_order::acquire);
+            if (_cursor == commit) return shm::ReadResult::Empty;
+            if (commit - _cursor > _capacity) return overrun();
+
+            if (const auto skip = ring::tail(_cursor, _capacity); skip) {
+                _cursor += skip;
+                continue;
+            }
+            const auto offset = _cursor & (_capacity - 1);
+            const auto room = _capacity - offset;
+
+            shm::RecordHeader header{};
+            std::memcpy(&header, _data + offset, sizeof(header));
+            if (!stillThere()) return overrun();
+            if (header.size < sizeof(header) || header.size > room
+                || sizeof(header) + header.addrsize + header.datasize > header.size) {
+                return overrun(); // can't be, unless it's garbage
+            }
+            if (header.kind == shm::RecordKind::Pad) {
+                _cursor += header.size;
+                continue;
+            }
+
+            const char *body = _data + offset + sizeof(header);
+            const shm::Record record{
+                header.seq, header.timestamp, header.kind, { body, header.addrsize },
+                { body + header.addrsize, header.datasize }
+            };
+            on_record(record);
+            if (!stillThere()) return overrun();
+
+            if (_next_seq && header.seq > *_next_seq) _lost += header.seq - *_next_seq;
+            _next_seq = header.seq + 1;
+            _cursor += header.size;
+            return shm::ReadResult::Record;
+        }
+    }
+
+    /**
+     * @brief Records that went by without us seeing them, known once we see the next one
+     */
+    [[nodiscard]] uint64_t lost() const
+    {
+        return _lost;
+    }
+
+private:
+    bool stillThere() const
+    {
+        std::atomic_thread_fence(std::memory_order::acquire);
+        return _header->reserve.load(std::memory_order::relaxed) - _cursor <= _capacity;
+    }
+
+    shm::ReadResult overrun()
+    {
+        _cursor = _header->commit.load(std::memory_order::acquire);
+        return shm::ReadResult::Overrun;
+    }
+
+    const char *_memory;
+    size_t _size;
+    const shm::RingHeader *_header;
+    size_t _capacity;
+    const char *_data;
+    uint64_t _cursor;
+    std::optional<uint64_t> _next_seq;
+    uint64_t _lost{ 0 };
+};
+
+} // namespace mmd
+
+#endif // SHMRING_HPP_
@@ -0,0 +1,286 @@
+/**
+ * @file SpillQueue.hpp
+ * @brief Contains implementation of a queue that overflows to an mmap'd file.
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef SPILLQUEUE_HPP_
+#define SPILLQUEUE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unistd.h>
+
+#include "Common.hpp"
+#include "MappedRing.hpp"
+
+namespace mmd {
+
+/**
+ * @brief Ring of ReceivedData records in a memory mapped file, one producer, one consumer.
+ * Only the used part of a record is stored, so small packets take little room;
+ * records are laid out the same way as in the shared memory ring.
+ * The file is unlinked right away: it's a buffer, not a log,
+ * and the kernel writes it back on its own when memory gets tight.
+ * All of it is allocated on disk up front, if there's no room for that the constructor throws.
+ */
+class SpillFile
+{
+public:
+    /**
+     * @param capacity Bytes, rounded up to a power of two; 0 means no file at all
+     */
+    SpillFile(const std::string &file_path, size_t capacity)
+    {
+        if (capacity == 0) return;
+        _capacity = 4096;
+        while (_capacity < capacity) _capacity *= 2;
+
+        const int fd = ::open(file_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd == -1) {
+            throw std::system_error(errno, std::generic_category(), "Failed to open spill file");
+        }
+        ::unlink(file_path.c_str());
+        _mapping.emplace(fd, _capacity, "spill file");
+        _data = _mapping->data();
+    }
+
+    SpillFile(const SpillFile &) = delete;
+    SpillFile &operator=(const SpillFile &) = delete;
+
+    /**
+     * @brief Producer side, appends a copy of the record
+     * @return false if there's no room, or no file
+     */
+    bool append(const ReceivedData &rdata)
+    {
+        if (!_data) return false;
+        const std::string_view addr{ rdata.addr, rdata.addrsize };
+        const std::string_view payload{ rdata.payload(), rdata.datasize };
+        const auto size = ring::align(sizeof(ring::RecordHeader) + addr.size() + payload.size());
+        const auto pad = ring::padding(_write, _capacity, size);
+        if (_write + pad + size - _read_pos.load(std::memory_order::acquire) > _capacity) {
+            return false;
+        }
+
+        ring::writePad(_data, _capacity, _write, pad, 0);
+        ring::writeRecord(_data, _capacity, _write + pad, 0, rdata.timestamp, ring::RecordKind::Raw,
+                          addr, payload);
+
+        _write += pad + size;
+        _write_pos.store(_write, std::memory_order::release);
+        return true;
+    }
+
+    /**
+     * @brief Consumer side, takes the oldest record out
+     * @param arena For payloads bigger than buf_size, same as in ReceivedData
+     */
+    std::optional<ReceivedData> take(BufferArena *arena)
+    {
+        const auto write = _write_pos.load(std::memory_order::acquire);
+        while (_read != write) {
+            if (const auto skip = ring::tail(_read, _capacity); skip) {
+                _read += skip;
+                continue;
+            }
+            const auto offset = _read & (_capacity - 1);
+            ring::RecordHeader header{};
+            std::memcpy(&header, _data + offset, sizeof(header));
+            if (header.kind == ring::RecordKind::Pad) {
+                _read += header.size;
+                continue;
+            }
+
+            const char *in = _data + offset + sizeof(header);
+            ReceivedData rdata{ std::string(in, header.addrsize),
+                                const_cast<char *>(in + header.addrsize), header.datasize, arena };
+            rdata.timestamp = header.timestamp; // when it came, not when we got to it
+            _read += header.size;
+            _read_pos.store(_read, std::memory_order::release);
+            return rdata;
+        }
+        _read_pos.store(_read, std::memory_order::release);
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Consumer side, whether there's nothing to take
+     */
+    [[nodiscard]] bool empty() const
+    {
+        return _read == _write_pos.load(std::memory_order::acquire);
+    }
+
+    /**
+     * @brief Producer side, whether everything appended has been taken
+     */
+    [[nodiscard]] bool drained() const
+    {
+        return _read_pos.load(std::memory_order::acquire) == _write;
+    }
+
+    /**
+     * @brief Bytes appended but not taken yet, from any thread
+     */
+    [[nodiscard]] size_t depthBytes() const
+    {
+        return _write_pos.load(std::memory_order::relaxed)
+                - _read_pos.load(std::memory_order::relaxed);
+    }
+
+    /**
+     * @brief Size of the ring in bytes, 0 if there's no file
+     */
+    [[nodiscard]] size_t capacity() const
+    {
+        return _capacity;
+    }
+
+private:
+    std::optional<ring::SharedMapping> _mapping;
+    char *_data{ nullptr };
+    size_t _capacity{ 0 };
+    uint64_t _write{ 0 }; // producer's own copy of _write_pos
+    uint64_t _read{ 0 }; // consumer's own copy of _read_pos
+    alignas(64) std::atomic<uint64_t> _write_pos{ 0 };
+    alignas(64) std::atomic<uint64_t> _read_pos{ 0 };
+};
+
+/**
+ * @brief Queue wrapper that puts what doesn't fit into the queue into a SpillFile.
+ * Once something is spilled, everything after it is spilled too until the consumer
+ * has taken all of it, and the consumer takes from the queue first,
+ * so records come out in the same order they went in.
+ * With spill capacity of 0 it's just the queue.
+ *
+ * Push is expected to be called from one thread and PopOptional from another,
+ * same as the underlying spsc queue.
+ *
+ * @tparam QueueT Something that is a queue with ReceivedData.
+ */
+template<typename QueueT>
+requires(Queue<QueueT, ReceivedData>) class SpillQueue
+{
+public:
+    /**
+     * @param arena Where spilled payloads bigger than buf_size go when taken back
+     */
+    SpillQueue(QueueT &queue, const std::string &file_path, size_t capacity,
+               BufferArena *arena = nullptr)
+        : _queue{ queue }
+        , _spill{ file_path, capacity }
+        , _arena{ arena }
+    {
+    }
+
+    bool Push(const ReceivedData &rdata)
+    {
+        if (_spill.drained() && _queue.get().Push(rdata)) {
+            _queued.fetch_add(1, std::memory_order::relaxed);
+            return true;
+        }
+        if (!_spill.append(rdata)) return false;
+        // the spill file has a copy now, and the buffer is ours to give back
+        BufferArena::release(rdata.large);
+        _spilled.fetch_add(1, std::memory_order::relaxed);
+        _spilled_bytes.fetch_add(rdata.datasize, std::memory_order::relaxed);
+        return true;
+    }
+
+    std::optional<ReceivedData> PopOptional()
+    {
+        if (auto result = popQueue(); result) return result;
+        if (_spill.empty()) return std::nullopt;
+        // the queue might have filled up and spilled over since we looked at it,
+        // and whatever is in it now is older than anything in the spill file
+        if (auto result = popQueue(); result) return result;
+        auto result = _spill.take(_arena);
+        if (result) _unspilled.fetch_add(1, std::memory_order::relaxed);
+        return result;
+    }
+
+    /**
+     * @brief Records ever spilled
+     */
+    [[nodiscard]] uint64_t spilled() const
+    {
+        return _spilled.load(std::memory_order::relaxed);
+    }
+
+    /**
+     * @brief Payload bytes ever spilled
+     */
+    [[nodiscard]] uint64_t spilledBytes() const
+    {
+        return _spilled_bytes.load(std::memory_order::relaxed);
+    }
+
+    /**
+     * @brief Records in the spill file right now
+     */
+    [[nodiscard]] uint64_t depth() const
+    {
+        return spilled() - _unspilled.load(std::memory_order::relaxed);
+    }
+
+    /**
+     * @brief Bytes of the spill file in use right now
+     */
+    [[nodiscard]] size_t depthBytes() const
+    {
+        return _spill.depthBytes();
+    }
+
+    /**
+     * @brief Size of the spill file, 0 if there's none
+     */
+    [[nodiscard]] size_t capacityBytes() const
+    {
+        return _spill.capacity();
+    }
+
+    /**
+     * @brief Records in the queue right now, the spilled ones are not counted
+     * Exact on the producer side, which is where AdmissionQueue looks at it.
+     */
+    [[nodiscard]] uint64_t queued() const
+    {
+        const auto popped = _dequeued.load(std::memory_order::relaxed);
+        return _queued.load(std::memory_order::relaxed) - popped;
+    }
+
+private:
+    std::optional<ReceivedData> popQueue()
+    {
+        auto result = _queue.get().PopOptional();
+        if (result) _dequeued.fetch_add(1, std::memory_order::relaxed);
+        return result;
+    }
+
+    std::reference_wrapper<QueueT> _queue;
+    SpillFile _spill;
+    BufferArena *_arena;
+    std::atomic<uint64_t> _spilled{ 0 };
+    std::atomic<uint64_t> _spilled_bytes{ 0 };
+    std::atomic<uint64_t> _unspilled{ 0 };
+    std::atomic<uint64_t> _queued{ 0 };
+    std::atomic<uint64_t> _dequeued{ 0 };
+};
+
+static_assert(Queue<SpillQueue<ReceiverQueue>, ReceivedData>,
+              "SpillQueue is supposed to be a Queue");
+
+} // namespace mmd
+
+#endif // SPILLQUEUE_HPP_
@@ -10,11 +10,15 @@
 #ifndef UDPSERVER_HPP_
 #define UDPSERVER_HPP_
 
+#include <asio/steady_timer.hpp>
 #include <asio/ts/buffer.hpp>
 #include <asio/ts/internet.hpp>
+#include <chrono>
 #include <functional>
 
 #include "Common.hpp"
+#include "DatagramReceiver.hpp"
+#include "UdpSocket.hpp"
 
 using asio::ip::udp;
 
@@ -31,61 +35,83 @@ template<typename RQueueT>
 requires(Queue<RQueueT, ReceivedData>) class UdpServer
 {
 public:
-    UdpServer(const std::string &address, short port, RQueueT &queue)
-        : _context()
-        , _socket(_context)
+    /**
+     * @param arena Where datagrams bigger than config::buf_size go, truncated if nullptr
+     */
+    UdpServer(const std::string &address, short port, RQueueT &queue,
+              BufferArena *arena = nullptr)
+        : _udp(address, port)
+        , _receiver(_udp.socket())
+        , _ticker(_udp.context())
         , _queue{ queue }
+        , _arena{ arena }
     {
-        auto addr = asio::ip::make_address(address);
-
-        udp::endpoint ep(addr, port);
-        _socket.open(ep.protocol());
-        _socket.set_option(asio::ip::udp::socket::reuse_address(true));
-
-        if (addr.is_multicast()) {
-            _socket.set_option(asio::ip::multicast::join_group(addr));
-        }
-        _socket.bind(ep);
+        _receiver.enableGro();
     }
 
     /**
      * @brief Runs the server
      * Technically, implements an endless pseudo-recursive callback async loop
+     * If the queue wants to be ticked (see AdmissionQueue::tick), does that too, on the same thread
      * Requires call for stop() to stop,
      * so better to run in a separate thread
      */
     void run()
     {
         do_receive();
-        _context.run();
+        do_tick();
+        _udp.context().run();
     }
 
     void stop()
     {
-        _socket.cancel();
-        _context.stop();
+        _udp.socket().cancel();
+        _ticker.cancel();
+        _udp.context().stop();
     }
 
 private:
     void do_receive()
     {
-        const auto callback = [this](std::error_code ec, std::size_t bytes_recvd) {
-            if (!ec && bytes_recvd > 0) {
-                ReceivedData rdata{ _sender.address().to_string(), _data, bytes_recvd };
-                [[maybe_unused]] const auto pr = _queue.get().Push(rdata);
+        const auto push = [this](const udp::endpoint &sender, char *data, size_t size) {
+            if (size == 0) return;
+            ReceivedData rdata{ sender.address().to_string(), data, size, _arena };
+            const auto pr = _queue.get().Push(rdata);
+            // not pushed means still ours
+            if (!pr) BufferArena::release(rdata.large);
 #ifdef BENCHMARK_LOGS
-                if (!pr) fmt::print("sfull\n");
+            if (!pr) fmt::print("sfull\n");
 #endif
+        };
+        const auto callback = [this, push](asio::error_code ec) {
+            if (ec == asio::error::operation_aborted) return;
+            for (size_t i{ 0 }; i < config::receive_batch && _receiver.receive(push); ++i) {
             }
             do_receive();
         };
-        _socket.async_receive_from(asio::buffer(_data, config::buf_size), _sender, callback);
+        _udp.socket().async_wait(udp::socket::wait_read, callback);
+    }
+    void do_tick()
+    {
+        if constexpr (requires(RQueueT &q) {
+                          q.tick();
+                          q.tickNs();
+                      }) {
+            const auto interval = _queue.get().tickNs();
+            if (interval == 0) return;
+            _ticker.expires_after(std::chrono::nanoseconds(interval));
+            _ticker.async_wait([this](asio::error_code ec) {
+                if (ec == asio::error::operation_aborted) return;
+                _queue.get().tick();
+                do_tick();
+            });
+        }
     }
-    asio::io_context _context;
-    udp::socket _socket;
-    udp::endpoint _sender;
-    char _data[config::buf_size];
+    UdpSocket _udp;
+    DatagramReceiver _receiver;
+    asio::steady_timer _ticker; // for the queue's tick
     std::reference_wrapper<RQueueT> _queue;
+    BufferArena *_arena;
 };
 } // namespace mmd
 
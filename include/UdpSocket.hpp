@@ -0,0 +1,59 @@
+/**
+ * @file UdpSocket.hpp
+ * @brief Contains implementation of a bound UDP socket with its own io_context
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef UDPSOCKET_HPP_
+#define UDPSOCKET_HPP_
+
+#include <asio/ts/internet.hpp>
+#include <string>
+
+namespace mmd {
+
+/**
+ * @brief Socket bound to the address and port, joined to the group if it's multicast
+ * Does no reading by itself, that's for UdpServer or CoroutinePipeline.
+ * The context is here too, so that whoever reads the socket gets one to run on.
+ */
+class UdpSocket
+{
+public:
+    UdpSocket(const std::string &address, short port)
+        : _context()
+        , _socket(_context)
+    {
+        auto addr = asio::ip::make_address(address);
+
+        asio::ip::udp::endpoint ep(addr, port);
+        _socket.open(ep.protocol());
+        _socket.set_option(asio::ip::udp::socket::reuse_address(true));
+
+        if (addr.is_multicast()) {
+            _socket.set_option(asio::ip::multicast::join_group(addr));
+        }
+        _socket.bind(ep);
+        _socket.non_blocking(true);
+    }
+
+    asio::io_context &context()
+    {
+        return _context;
+    }
+
+    asio::ip::udp::socket &socket()
+    {
+        return _socket;
+    }
+
+private:
+    asio::io_context _context;
+    asio::ip::udp::socket _socket;
+};
+} // namespace mmd
+
+#endif // UDPSOCKET_HPP_
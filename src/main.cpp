@@ -8,12 +8,19 @@
 #include <thread>
 #include <unistd.h>
 
+#include "AdmissionQueue.hpp"
 #include "BasicFormatter.hpp"
 #include "Common.hpp"
+#include "CoroutinePipeline.hpp"
 #include "FileDataWriter.hpp"
 #include "FormatWorker.hpp"
+#include "LogIndex.hpp"
 #include "Params.hpp"
+#include "PublishingFormatter.hpp"
+#include "ShmRing.hpp"
+#include "SpillQueue.hpp"
 #include "UdpServer.hpp"
+#include "UdpSocket.hpp"
 
 /**
  * @brief Pauses the main thread and waits for input from the user. 
@@ -36,31 +43,29 @@ void waitForQuitSignal(bool &signal_quit)
     tcsetattr(STDIN_FILENO, TCSANOW, &oldt); // Restore original settings
 }
 
-int main(int argc, char **argv)
-try {
-    mmd::Params params(argc, argv);
-    if (params.requestedHelp()) {
-        fmt::print("{}\n", params.help());
-        return 0;
-    }
-
-    fmt::print("Starting server at {}:{} with filter string {}\nWriting log to {}\n",
-               params.address(), params.port(), params.filter(), params.filename());
+/**
+ * @brief Runs server, formatter and writer each in its own thread, connected by queues
+ */
+template<mmd::Formatter FormatterT>
+void runThreaded(const mmd::Params &params, FormatterT &formatter, mmd::BufferArena &arena)
+{
+    // global signal to stop things
+    bool signal_quit{ false };
 
     // init the queues to transfer from server to formatter to writer
     mmd::ReceiverQueue rqueue;
     mmd::FormatterQueue fqueue;
-
-    // global signal to stop things
-    bool signal_quit{ false };
+    // what doesn't fit into the rqueue goes to a file next to the log, in order, if asked for
+    mmd::SpillQueue squeue(rqueue, params.filename() + ".spill", params.spillSize(), &arena);
+    // overload protection, sits on top and sheds noisy sources first
+    mmd::AdmissionQueue aqueue(squeue, params.admission());
 
     // formatting part
     // separated to make things spicier, and to test it properly
     // runs in it's own thread
     // Separating formatter and queues helps with mocking, yada, yada, yada
     // Any exception stops all things
-    mmd::BasicFormatter formatter;
-    mmd::FormatWorker fworker(formatter, rqueue, fqueue);
+    mmd::FormatWorker fworker(formatter, aqueue, fqueue);
     auto fthread = std::thread([&fworker, &signal_quit] {
         try {
             fworker.run();
@@ -74,7 +79,7 @@ try {
     // the same approach here, but only the queue is moved to templated args
     // ideally the server should be separated from worker, same as with formatter
     // Any exception stops all things
-    mmd::UdpServer server(params.address(), params.port(), rqueue);
+    mmd::UdpServer server(params.address(), params.port(), aqueue, &arena);
     auto sthread = std::thread([&server, &signal_quit] {
         try {
             server.run();
@@ -88,14 +93,19 @@ try {
     // runs in it's own thread, apparently
     // could be the same as formatter and server thing, with its own tests, but ¯\_(ツ)_/¯
     // Any exception stops all things
-    auto wthread = std::thread([filename = params.filename(), &fqueue, &signal_quit] {
+    auto wthread = std::thread([filename = params.filename(), format = params.outputFormat(),
+                                &fqueue, &signal_quit] {
         try {
             mmd::FileDataWriter fwriter(filename);
+            mmd::IndexWriter iwriter(filename, format);
             while (!signal_quit) {
                 const auto i = fqueue.PopOptional();
-                if (i) {
-                    fwriter.write({ i.value().data, i.value().datasize });
+                if (i && i.value().datasize > 0) {
+                    const auto offset = fwriter.offset();
+                    fwriter.write(i.value().view());
+                    iwriter.add(offset, i.value().datasize, i.value().timestamp, i.value().source);
                 }
+                if (i) mmd::BufferArena::release(i.value().large);
             }
         } catch (std::exception &e) {
             fmt::print("wthread failed with exception: {}", e.what());
@@ -113,6 +123,112 @@ try {
     sthread.join();
     wthread.join();
     fthread.join();
+
+    if (const auto shed = aqueue.shedByRate() + aqueue.shedBySampling() + aqueue.shedByQueue();
+        shed > 0) {
+        fmt::print("Shed {} records: {} over the rate, {} sampled out, {} with the queue full\n",
+                   shed, aqueue.shedByRate(), aqueue.shedBySampling(), aqueue.shedByQueue());
+    }
+    if (squeue.spilled() > 0) {
+        fmt::print("Spilled {} records ({} bytes), {} left unwritten ({} bytes of the file)\n",
+                   squeue.spilled(), squeue.spilledBytes(), squeue.depth(), squeue.depthBytes());
+    }
+}
+
+/**
+ * @brief Runs the whole pipeline as coroutines on the server's io_context, in one thread
+ * The main thread only waits for the user to quit.
+ */
+template<mmd::Formatter FormatterT>
+void runSingleThreaded(const mmd::Params &params, FormatterT &formatter, mmd::BufferArena &arena)
+{
+    // global signal to stop things
+    bool signal_quit{ false };
+
+    // no server here, the pipeline reads the socket itself
+    mmd::UdpSocket udp(params.address(), params.port());
+    mmd::CoroutinePipeline pipeline(udp.context(), udp.socket(), formatter, params.filename(),
+                                    &arena, params.outputFormat());
+    pipeline.start();
+
+    // Any exception stops all things
+    auto sthread = std::thread([&udp, &signal_quit] {
+        try {
+            udp.context().run();
+        } catch (std::exception &e) {
+            fmt::print("sthread failed with exception: {}", e.what());
+            signal_quit = true;
+        }
+    });
+
+    fmt::print("q to quit\n");
+    waitForQuitSignal(signal_quit);
+
+    fmt::print("Stopping work; press ^C to force stop\n");
+    // lets the writer finish what was received, then the context runs out of work
+    pipeline.stop();
+    sthread.join();
+    pipeline.finish();
+}
+
+template<mmd::Formatter FormatterT>
+void run(const mmd::Params &params, FormatterT &formatter, mmd::BufferArena &arena)
+{
+    if (params.singleThread()) {
+        runSingleThreaded(params, formatter, arena);
+    } else {
+        runThreaded(params, formatter, arena);
+    }
+}
+
+/**
+ * @brief Sets up the formatter for the output format, and the shared memory if asked for
+ */
+template<mmd::OutputFormat Format>
+void serve(const mmd::Params &params, mmd::BufferArena &arena)
+{
+    mmd::BasicFormatter<Format> formatter(params.filter(), &arena);
+
+    if (params.shmName().empty()) {
+        run(params, formatter, arena);
+    } else {
+        // local consumers get the records from shared memory as they're formatted
+        mmd::ShmRingWriter ring(params.shmName(), mmd::config::shm_ring_size);
+        mmd::PublishingFormatter pformatter(formatter, ring, params.shmRaw());
+        fmt::print("Publishing {} records to shared memory {}\n",
+                   params.shmRaw() ? "raw" : "formatted", params.shmName());
+        run(params, pformatter, arena);
+    }
+}
+
+int main(int argc, char **argv)
+try {
+    mmd::Params params(argc, argv);
+    if (params.requestedHelp()) {
+        fmt::print("{}\n", params.help());
+        return 0;
+    }
+
+    fmt::print("Starting server at {}:{} with filter string {}\nWriting log to {}\n",
+               params.address(), params.port(), params.filter(), params.filename());
+
+    // datagrams too big for the queue entries go here
+    mmd::BufferArena arena({ mmd::config::jumbo_buffer_size, mmd::config::large_buffer_size },
+                           mmd::config::large_buffer_count);
+
+    // the format is a template argument, so the choice is made here once and not per record
+    switch (params.outputFormat()) {
+    case mmd::OutputFormat::Plain: serve<mmd::OutputFormat::Plain>(params, arena); break;
+    case mmd::OutputFormat::Csv: serve<mmd::OutputFormat::Csv>(params, arena); break;
+    case mmd::OutputFormat::Json: serve<mmd::OutputFormat::Json>(params, arena); break;
+    }
+
+    if (const auto truncated = mmd::stats::truncated.load(); truncated > 0) {
+        fmt::print("Truncated or dropped {} payloads that didn't fit\n", truncated);
+    }
+    if (const auto unpublished = mmd::stats::unpublished.load(); unpublished > 0) {
+        fmt::print("Didn't publish {} records too big for the shared memory ring\n", unpublished);
+    }
 } catch (const cxxopts::exceptions::exception &e) {
     fmt::print("Error parsing command line args. Try --help for usage details.");
     return 1;
@@ -0,0 +1,196 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "AdmissionQueue.hpp"
+#include "Common.hpp"
+
+using namespace mmd;
+
+namespace {
+ReceivedData makeData(const std::string &addr)
+{
+    char payload[] = "payload";
+    return ReceivedData{ addr, payload, sizeof(payload) - 1 };
+}
+constexpr uint64_t ms = 1'000'000;
+} // namespace
+
+TEST_CASE("Token bucket limits noisy sources only", "[admission]")
+{
+    ReceiverQueue rqueue;
+    AdmissionQueue aqueue(rqueue, AdmissionSettings{ .rate = 100, .burst = 10, .sample = 0 });
+
+    const auto noisy = makeData("10.0.0.1");
+    const auto quiet = makeData("10.0.0.2");
+
+    size_t noisy_passed{ 0 };
+    size_t quiet_passed{ 0 };
+    for (uint64_t i{ 1 }; i <= 100; ++i) {
+        // noisy sends every 1ms, i.e. 1000/s, quiet sends every 20ms, i.e. 50/s
+        if (aqueue.admit(noisy, i * ms)) noisy_passed++;
+        if (i % 20 == 0 && aqueue.admit(quiet, i * ms)) quiet_passed++;
+    }
+
+    REQUIRE(quiet_passed == 5);
+    // burst of 10 plus 100/s for 100ms
+    REQUIRE(noisy_passed >= 19);
+    REQUIRE(noisy_passed <= 21);
+    REQUIRE(aqueue.shedByRate() == 100 - noisy_passed);
+}
+
+TEST_CASE("Sampling kicks in when queue fills up", "[admission]")
+{
+    ReceiverQueue rqueue;
+    AdmissionQueue aqueue(rqueue, AdmissionSettings{ .rate = 0, .sample = 4 });
+
+    const auto noisy = makeData("10.0.0.1");
+    REQUIRE(aqueue.samplingStep() == 1);
+
+    // nobody pops, so the occupancy only grows
+    for (size_t i{ 0 }; i < config::queue_size / 2; ++i) {
+        REQUIRE(aqueue.Push(noisy));
+    }
+    REQUIRE(aqueue.samplingStep() == 4);
+
+    size_t passed{ 0 };
+    for (size_t i{ 0 }; i < 16; ++i) {
+        if (aqueue.Push(noisy)) passed++;
+    }
+    REQUIRE(passed == 4);
+    REQUIRE(aqueue.shedBySampling() == 12);
+
+    while (aqueue.PopOptional()) {
+    }
+    REQUIRE(aqueue.occupancy() == 0);
+    REQUIRE(aqueue.samplingStep() == 1);
+}
+
+TEST_CASE("Quiet sources are not sampled", "[admission]")
+{
+    ReceiverQueue rqueue;
+    AdmissionQueue aqueue(rqueue, AdmissionSettings{ .rate = 1000, .burst = 100, .sample = 4 });
+
+    const auto noisy = makeData("10.0.0.1");
+    for (size_t i{ 0 }; i < config::queue_size / 2; ++i) {
+        aqueue.Push(noisy);
+    }
+    REQUIRE(aqueue.samplingStep() > 1);
+
+    // one message from a new source with a full bucket
+    const auto quiet = makeData("10.0.0.2");
+    REQUIRE(aqueue.admit(quiet, 1));
+    REQUIRE(aqueue.admit(quiet, 1'000 * ms));
+}
+
+TEST_CASE("Sources under the rate limit are sampled when they fill the queue", "[admission]")
+{
+    ReceiverQueue rqueue;
+    AdmissionQueue aqueue(rqueue); // defaults, sampling 1-in-8 and 1-in-64
+
+    // whoever fills the queue gets sampled too, so keep pushing until it's 3/4 full
+    const auto filler = makeData("10.0.0.3");
+    while (aqueue.occupancy() * 4 < config::queue_size * 3) {
+        aqueue.Push(filler);
+    }
+    REQUIRE(aqueue.samplingStep() == config::sample_step * config::sample_step);
+
+    const auto noisy = makeData("10.0.0.1");
+    const auto quiet = makeData("10.0.0.2");
+    size_t noisy_passed{ 0 };
+    size_t quiet_passed{ 0 };
+    const uint64_t start = 1000 * ms;
+    for (uint64_t i{ 0 }; i < 8000; ++i) {
+        // noisy sends 8000/s, within the default rate, quiet sends 10/s
+        const auto now = start + i * 125'000;
+        if (aqueue.admit(noisy, now)) noisy_passed++;
+        if (i % 800 == 0 && aqueue.admit(quiet, now)) quiet_passed++;
+    }
+
+    REQUIRE(quiet_passed == 10);
+    REQUIRE(aqueue.shedByRate() == 0);
+    // a new source is quiet for its first window's worth of the quiet rate, 10 packets
+    REQUIRE(noisy_passed >= 8000 / 64);
+    REQUIRE(noisy_passed <= 8000 / 64 + 11);
+}
+
+TEST_CASE("Shedding is reported with a summary record", "[admission]")
+{
+    ReceiverQueue rqueue;
+    AdmissionQueue aqueue(rqueue,
+                          AdmissionSettings{ .rate = 1, .burst = 1, .sample = 0, .summary_ns = 0 });
+
+    const auto noisy = makeData("10.0.0.1");
+    REQUIRE(aqueue.Push(noisy));
+    REQUIRE_FALSE(aqueue.Push(noisy)); // out of tokens
+    REQUIRE_FALSE(aqueue.Push(noisy)); // summary goes first, then this is shed too
+
+    const auto first = aqueue.PopOptional();
+    REQUIRE(first);
+    REQUIRE(std::string_view(first->addr, first->addrsize) == "10.0.0.1");
+
+    const auto summary = aqueue.PopOptional();
+    REQUIRE(summary);
+    REQUIRE(std::string_view(summary->addr, summary->addrsize) == "mmdsrv");
+    REQUIRE(std::string_view(summary->data, summary->datasize).starts_with("shed;rate;1;"));
+
+    REQUIRE_FALSE(aqueue.PopOptional());
+}
+
+TEST_CASE("Idle sources give their slots to new ones", "[admission]")
+{
+    SourceTable table;
+    const uint64_t stale = 100 * ms;
+
+    // more sources than the table can hold
+    for (size_t i{ 0 }; i < config::source_table_size * 2; ++i) {
+        table.lookup("10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256), 1, stale)
+                .last_ns.store(1);
+    }
+
+    WHEN("they are still active")
+    {
+        THEN("new sources share the overflow slot")
+        {
+            auto &first = table.lookup("192.168.0.1", 10 * ms, stale);
+            auto &second = table.lookup("192.168.0.2", 10 * ms, stale);
+            REQUIRE(&first == &second);
+            REQUIRE(table.reclaimed() == 0);
+        }
+    }
+    WHEN("they have been idle for a while")
+    {
+        THEN("new sources get slots of their own, starting afresh")
+        {
+            auto &first = table.lookup("192.168.0.1", 1000 * ms, stale);
+            auto &second = table.lookup("192.168.0.2", 1000 * ms, stale);
+            REQUIRE(&first != &second);
+            REQUIRE(first.last_ns.load() == 0);
+            REQUIRE(table.reclaimed() == 2);
+            REQUIRE(&table.lookup("192.168.0.1", 1000 * ms, stale) == &first);
+        }
+    }
+}
+
+TEST_CASE("Summary goes out on tick when nothing comes in", "[admission]")
+{
+    ReceiverQueue rqueue;
+    AdmissionQueue aqueue(rqueue,
+                          AdmissionSettings{ .rate = 1, .burst = 1, .sample = 0, .summary_ns = 1 });
+
+    const auto noisy = makeData("10.0.0.1");
+    REQUIRE(aqueue.Push(noisy));
+    REQUIRE_FALSE(aqueue.Push(noisy)); // out of tokens, nobody to report it until the tick
+    REQUIRE(aqueue.PopOptional());
+    REQUIRE_FALSE(aqueue.PopOptional());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    aqueue.tick();
+    const auto summary = aqueue.PopOptional();
+    REQUIRE(summary);
+    REQUIRE(std::string_view(summary->addr, summary->addrsize) == "mmdsrv");
+    REQUIRE(std::string_view(summary->data, summary->datasize).starts_with("shed;rate;1;"));
+}
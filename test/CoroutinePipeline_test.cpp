@@ -0,0 +1,59 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+#include "BasicFormatter.hpp"
+#include "CoroutinePipeline.hpp"
+#include "MappedFile.hpp"
+
+using namespace mmd;
+using asio::ip::udp;
+
+TEST_CASE("Coroutine pipeline writes what it receives", "[coroutine]")
+{
+    namespace fs = std::filesystem;
+    const auto path = (fs::temp_directory_path() / "mmd_coroutine_test.log").string();
+
+    GIVEN("Pipeline listening on a local port")
+    {
+        asio::io_context context;
+        udp::socket socket(context, udp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+        BasicFormatter formatter;
+
+        {
+            CoroutinePipeline pipeline(context, socket, formatter, path);
+            pipeline.start();
+
+            WHEN("a few datagrams arrive")
+            {
+                udp::socket sender(context, udp::v4());
+                for (int i{ 0 }; i < 10; ++i) {
+                    const auto msg = "message " + std::to_string(i);
+                    sender.send_to(asio::buffer(msg), socket.local_endpoint());
+                }
+                context.run_for(std::chrono::milliseconds(200));
+                pipeline.stop();
+                context.run(); // until the writer is done
+                pipeline.finish();
+
+                THEN("all of them are in the file, in order")
+                {
+                    MappedFile log(path);
+                    const auto data = log.view();
+                    size_t pos{ 0 };
+                    for (int i{ 0 }; i < 10; ++i) {
+                        const auto msg = "data;message " + std::to_string(i) + "\n";
+                        pos = data.find(msg, pos);
+                        REQUIRE(pos != std::string_view::npos);
+                    }
+                }
+            }
+        }
+    }
+
+    fs::remove(path);
+    fs::remove(path + index::suffix);
+}
@@ -0,0 +1,175 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "BasicFormatter.hpp"
+#include "BufferArena.hpp"
+#include "Common.hpp"
+#include "DatagramReceiver.hpp"
+
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+using namespace mmd;
+using asio::ip::udp;
+
+TEST_CASE("Arena hands out every buffer once", "[large]")
+{
+    BufferArena arena(100, 3);
+
+    char *a = arena.acquire();
+    char *b = arena.acquire();
+    char *c = arena.acquire();
+    REQUIRE(a);
+    REQUIRE(b);
+    REQUIRE(c);
+    REQUIRE(a != b);
+    REQUIRE(b != c);
+    REQUIRE_FALSE(arena.acquire());
+
+    BufferArena::release(b);
+    REQUIRE(arena.acquire() == b);
+    BufferArena::release(nullptr); // fine, does nothing
+}
+
+TEST_CASE("Arena picks the smallest size class that fits", "[large]")
+{
+    BufferArena arena({ 1000, 100 }, 1);
+
+    char *small = arena.acquire(50);
+    REQUIRE(BufferArena::capacity(small) == 100);
+    // small ones are gone, a bigger one will do
+    char *fallback = arena.acquire(50);
+    REQUIRE(BufferArena::capacity(fallback) == 1000);
+    REQUIRE_FALSE(arena.acquire(50));
+    REQUIRE_FALSE(arena.acquire(2000));
+
+    BufferArena::release(small);
+    BufferArena::release(fallback);
+    REQUIRE(arena.acquire(500) == fallback);
+    REQUIRE(arena.bufferSize() == 1000);
+}
+
+TEST_CASE("Default pool covers full queues of jumbo frames", "[large]")
+{
+    BufferArena arena({ config::jumbo_buffer_size, config::large_buffer_size },
+                      config::large_buffer_count);
+    std::vector<char> jumbo(9000, 'j');
+    const auto truncated = stats::truncated.load();
+
+    ReceiverQueue rqueue;
+    FormatterQueue fqueue;
+    BasicFormatter formatter("", &arena);
+    while (rqueue.Push({ "10.0.0.1", jumbo.data(), jumbo.size(), &arena })) {
+    }
+    // and as many formatted ones waiting for the writer
+    for (size_t i{ 0 }; i + 1 < config::queue_size; ++i) {
+        REQUIRE(fqueue.Push(formatter.format({ "10.0.0.1", jumbo.data(), jumbo.size(), &arena })));
+    }
+    REQUIRE(stats::truncated.load() == truncated);
+
+    while (auto rdata = rqueue.PopOptional()) {
+        REQUIRE(rdata->datasize == jumbo.size());
+        REQUIRE(BufferArena::capacity(rdata->large) == config::jumbo_buffer_size);
+        BufferArena::release(rdata->large);
+    }
+    while (auto fdata = fqueue.PopOptional()) BufferArena::release(fdata->large);
+}
+
+TEST_CASE("Big payloads go out of line", "[large]")
+{
+    std::vector<char> payload(config::buf_size * 4, 'x');
+
+    WHEN("there's an arena")
+    {
+        BufferArena arena(config::large_buffer_size, 2);
+        ReceivedData rdata{ "10.0.0.1", payload.data(), payload.size(), &arena };
+
+        THEN("all of it is kept, and formatted")
+        {
+            REQUIRE(rdata.large);
+            REQUIRE(rdata.datasize == payload.size());
+            REQUIRE(std::string_view(rdata.payload(), rdata.datasize)
+                    == std::string(payload.size(), 'x'));
+
+            BasicFormatter formatter("", &arena);
+            const auto fdata = formatter.format(rdata);
+            BufferArena::release(rdata.large);
+            REQUIRE(fdata.large);
+            REQUIRE(fdata.view().ends_with(std::string(payload.size(), 'x') + "\n"));
+            BufferArena::release(fdata.large);
+        }
+    }
+    WHEN("there's no arena")
+    {
+        const auto truncated = stats::truncated.load();
+        ReceivedData rdata{ "10.0.0.1", payload.data(), payload.size() };
+
+        THEN("it's truncated, same as before, and counted")
+        {
+            REQUIRE_FALSE(rdata.large);
+            REQUIRE(rdata.datasize == config::buf_size);
+            REQUIRE(stats::truncated.load() == truncated + 1);
+        }
+    }
+}
+
+TEST_CASE("Receiver gets full size datagrams", "[large]")
+{
+    asio::io_context context;
+    udp::socket socket(context, udp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+    DatagramReceiver receiver(socket);
+    receiver.enableGro(); // may or may not coalesce on loopback, result must be the same
+
+    udp::socket sender(context, udp::v4());
+    const std::string big(9000, 'b');
+    const std::string small(100, 's');
+    sender.send_to(asio::buffer(big), socket.local_endpoint());
+    for (int i{ 0 }; i < 3; ++i) {
+        sender.send_to(asio::buffer(small), socket.local_endpoint());
+    }
+
+    std::vector<std::string> received;
+    const auto collect = [&received](const udp::endpoint &, char *data, size_t size) {
+        received.emplace_back(data, size);
+    };
+    while (receiver.receive(collect)) {
+    }
+
+    REQUIRE(received.size() == 4);
+    REQUIRE(received[0] == big);
+    REQUIRE(received[3] == small);
+}
+
+#ifdef UDP_SEGMENT
+TEST_CASE("Receiver splits GRO reads back into datagrams", "[large]")
+{
+    asio::io_context context;
+    udp::socket socket(context, udp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+    DatagramReceiver receiver(socket);
+    const bool gro = receiver.enableGro();
+
+    // the sender has the kernel cut one send into 1000 byte datagrams
+    udp::socket sender(context, udp::v4());
+    int segment{ 1000 };
+    REQUIRE(::setsockopt(sender.native_handle(), SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment))
+            == 0);
+    std::string payload;
+    for (int i{ 0 }; i < 4500; ++i) payload += static_cast<char>('a' + i % 26);
+    sender.send_to(asio::buffer(payload), socket.local_endpoint());
+
+    std::vector<std::string> received;
+    size_t reads{ 0 };
+    const auto collect = [&received](const udp::endpoint &, char *data, size_t size) {
+        received.emplace_back(data, size);
+    };
+    while (receiver.receive(collect)) reads++;
+
+    REQUIRE(received.size() == 5);
+    for (size_t i{ 0 }; i < 4; ++i) REQUIRE(received[i] == payload.substr(i * 1000, 1000));
+    REQUIRE(received[4] == payload.substr(4000));
+    if (gro) REQUIRE(reads < received.size()); // came in coalesced, and was split here
+}
+#endif
@@ -0,0 +1,187 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <filesystem>
+#include <fmt/format.h>
+#include <string>
+#include <string_view>
+
+#include "Common.hpp"
+#include "FileDataWriter.hpp"
+#include "LogIndex.hpp"
+#include "LogRecord.hpp"
+#include "MappedFile.hpp"
+
+using namespace mmd;
+
+TEST_CASE("Records are parsed back", "[index]")
+{
+    const auto rec = parseRecord("ts;1729240000;addr;10.0.0.1;type;ascii;data;a;b;c");
+    REQUIRE(rec);
+    REQUIRE(rec->timestamp == 1729240000);
+    REQUIRE(rec->addr == "10.0.0.1");
+    REQUIRE(rec->type == "ascii");
+    REQUIRE(rec->data == "a;b;c");
+
+    REQUIRE_FALSE(parseRecord("ts;abc;addr;10.0.0.1;type;ascii;data;x"));
+    REQUIRE_FALSE(parseRecord("some garbage"));
+}
+
+TEST_CASE("Binary data is decoded from hex", "[index]")
+{
+    char out[4]{};
+    REQUIRE(decodeHex("1822f2FF", out) == 4);
+    REQUIRE(std::string_view(out, 4) == "\x18\x22\xf2\xff");
+    REQUIRE_FALSE(decodeHex("123", out));
+    REQUIRE_FALSE(decodeHex("zz", out));
+}
+
+TEST_CASE("Cursor keeps multiline records together", "[index]")
+{
+    RecordCursor cursor("ts;1;addr;a;type;ascii;data;one\ntwo\nts;2;addr;b;type;ascii;data;x\n");
+    REQUIRE(cursor.next() == "ts;1;addr;a;type;ascii;data;one\ntwo");
+    REQUIRE(cursor.next() == "ts;2;addr;b;type;ascii;data;x");
+    REQUIRE_FALSE(cursor.next());
+}
+
+TEST_CASE("CSV records are parsed back", "[index]")
+{
+    RecordCursor cursor("1,10.0.0.1,ascii,plain\n"
+                        "2,10.0.0.2,ascii,\"one, \"\"two\"\"\nthree\"\n"
+                        "3,10.0.0.3,bin,00ff\n",
+                        OutputFormat::Csv);
+
+    const auto first = parseRecord(cursor.next().value(), OutputFormat::Csv);
+    REQUIRE(first);
+    REQUIRE(first->timestamp == 1);
+    REQUIRE(first->addr == "10.0.0.1");
+    REQUIRE(first->data == "plain");
+    REQUIRE_FALSE(first->escaped);
+
+    // the newline in the quotes doesn't end the record
+    const auto second = parseRecord(cursor.next().value(), OutputFormat::Csv);
+    REQUIRE(second);
+    REQUIRE(second->timestamp == 2);
+    REQUIRE(second->escaped);
+    char out[32]{};
+    const auto size = unescapeData(*second, out);
+    REQUIRE(size);
+    REQUIRE(std::string_view(out, *size) == "one, \"two\"\nthree");
+
+    const auto third = parseRecord(cursor.next().value(), OutputFormat::Csv);
+    REQUIRE(third);
+    REQUIRE(third->type == "bin");
+    REQUIRE(third->data == "00ff");
+    REQUIRE_FALSE(cursor.next());
+
+    REQUIRE_FALSE(parseRecord("x,10.0.0.1,ascii,a", OutputFormat::Csv));
+    REQUIRE_FALSE(parseRecord("1,10.0.0.1,ascii,\"unterminated", OutputFormat::Csv));
+}
+
+TEST_CASE("JSON records are parsed back", "[index]")
+{
+    RecordCursor cursor(R"({"ts":1,"addr":"10.0.0.1","type":"ascii","data":"plain"})"
+                        "\n"
+                        R"({"ts":2,"addr":"10.0.0.2","type":"utf8","data":"a\"b\\c\n\u0001\u00e9"})"
+                        "\n",
+                        OutputFormat::Json);
+
+    const auto first = parseRecord(cursor.next().value(), OutputFormat::Json);
+    REQUIRE(first);
+    REQUIRE(first->timestamp == 1);
+    REQUIRE(first->addr == "10.0.0.1");
+    REQUIRE(first->type == "ascii");
+    REQUIRE(first->data == "plain");
+    REQUIRE_FALSE(first->escaped);
+
+    const auto second = parseRecord(cursor.next().value(), OutputFormat::Json);
+    REQUIRE(second);
+    REQUIRE(second->escaped);
+    char out[32]{};
+    const auto size = unescapeData(*second, out);
+    REQUIRE(size);
+    REQUIRE(std::string_view(out, *size) == "a\"b\\c\n\x01\xc3\xa9");
+    REQUIRE_FALSE(cursor.next());
+
+    REQUIRE_FALSE(parseRecord(R"({"ts":1,"addr":"a","type":"ascii","data":"x")",
+                              OutputFormat::Json));
+    REQUIRE_FALSE(unescapeData(*parseRecord(R"({"ts":1,"addr":"a","type":"ascii","data":"\q"})",
+                                            OutputFormat::Json),
+                               out));
+}
+
+TEST_CASE("Index finds blocks by time and source", "[index]")
+{
+    namespace fs = std::filesystem;
+    const auto path = (fs::temp_directory_path() / "mmd_index_test.log").string();
+
+    {
+        FileDataWriter fwriter(path);
+        IndexWriter iwriter(path, OutputFormat::Plain, 256);
+        for (size_t i{ 0 }; i < 100; ++i) {
+            const std::string addr = i < 50 ? "10.0.0.1" : "10.0.0.2";
+            const auto line = fmt::format("ts;{};addr;{};type;ascii;data;record {}\n", 1000 + i,
+                                          addr, i);
+            const auto offset = fwriter.offset();
+            fwriter.write(line);
+            iwriter.add(offset, line.size(), 1000 + i, sourceKey(addr));
+        }
+    }
+
+    MappedFile log(path);
+    IndexReader index(path);
+
+    REQUIRE(index.blocks().size() > 1);
+    REQUIRE(index.indexedSize() == log.size());
+
+    size_t records{ 0 };
+    uint64_t expected_offset{ 0 };
+    for (const auto &block : index.blocks()) {
+        REQUIRE(block.offset == expected_offset);
+        REQUIRE(log.view().substr(block.offset).starts_with("ts;"));
+        REQUIRE(block.ts_min <= block.ts_max);
+        expected_offset += block.size;
+        records += block.records;
+    }
+    REQUIRE(records == 100);
+
+    const auto &first = index.blocks().front();
+    const auto &last = index.blocks().back();
+    REQUIRE(first.ts_min == 1000);
+    REQUIRE(last.ts_max == 1099);
+    REQUIRE(index::bloomMayContain(first, sourceKey("10.0.0.1")));
+    REQUIRE(index::bloomMayContain(last, sourceKey("10.0.0.2")));
+
+    fs::remove(path);
+    fs::remove(path + index::suffix);
+}
+
+TEST_CASE("Index knows the format of the log", "[index]")
+{
+    namespace fs = std::filesystem;
+    const auto path = (fs::temp_directory_path() / "mmd_index_format_test.log").string();
+    const std::string json{ R"({"ts":1000,"addr":"10.0.0.1","type":"ascii","data":"x"})" "\n" };
+
+    {
+        FileDataWriter fwriter(path);
+        IndexWriter iwriter(path, OutputFormat::Json);
+        fwriter.write(json);
+        iwriter.add(0, json.size(), 1000, sourceKey("10.0.0.1"));
+    }
+    REQUIRE(IndexReader(path).format() == OutputFormat::Json);
+    REQUIRE(logFormat(path, json) == OutputFormat::Json);
+
+    WHEN("there's no index")
+    {
+        fs::remove(path + index::suffix);
+        THEN("it's told by the first record")
+        {
+            REQUIRE(logFormat(path, json) == OutputFormat::Json);
+            REQUIRE(logFormat(path, "1000,10.0.0.1,ascii,x\n") == OutputFormat::Csv);
+            REQUIRE(logFormat(path, "ts;1000;addr;10.0.0.1;type;ascii;data;x\n")
+                    == OutputFormat::Plain);
+        }
+    }
+
+    fs::remove(path);
+    fs::remove(path + index::suffix);
+}
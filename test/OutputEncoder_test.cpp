@@ -0,0 +1,147 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "BasicFormatter.hpp"
+#include "BufferArena.hpp"
+#include "OutputEncoder.hpp"
+
+using namespace mmd;
+
+namespace {
+template<OutputFormat Format>
+std::string formatted(std::string_view payload, BufferArena *arena = nullptr)
+{
+    ReceivedData rdata{ "10.0.0.1", const_cast<char *>(payload.data()), payload.size(), arena };
+    rdata.timestamp = 1729240000;
+    BasicFormatter<Format> formatter("", arena);
+    const auto fdata = formatter.format(rdata);
+    std::string result{ fdata.view() };
+    BufferArena::release(rdata.large);
+    BufferArena::release(fdata.large);
+    return result;
+}
+} // namespace
+
+TEST_CASE("Escape scan finds the first byte wherever it is", "[encoder]")
+{
+    for (size_t at{ 0 }; at < 70; ++at) {
+        std::string data(70, 'a');
+        data[at] = ',';
+        REQUIRE(escape::find<OutputFormat::Csv>(data.data(), data.size()) == at);
+        data[at] = '\x01';
+        REQUIRE(escape::find<OutputFormat::Json>(data.data(), data.size()) == at);
+        REQUIRE(escape::find<OutputFormat::Csv>(data.data(), data.size()) == data.size());
+    }
+
+    // bytes past 0x7f are not control characters
+    const std::string utf8{ "Тук имаме някои UTF-8 кодирани данни" };
+    REQUIRE(escape::find<OutputFormat::Json>(utf8.data(), utf8.size()) == utf8.size());
+}
+
+TEST_CASE("Plain format stays as it was", "[encoder]")
+{
+    REQUIRE(formatted<OutputFormat::Plain>("a;b\nc")
+            == "ts;1729240000;addr;10.0.0.1;type;ascii;data;a;b\nc\n");
+}
+
+TEST_CASE("CSV quotes only what needs quoting", "[encoder]")
+{
+    REQUIRE(formatted<OutputFormat::Csv>("plain text;with semicolons")
+            == "1729240000,10.0.0.1,ascii,plain text;with semicolons\n");
+    REQUIRE(formatted<OutputFormat::Csv>("a,b") == "1729240000,10.0.0.1,ascii,\"a,b\"\n");
+    REQUIRE(formatted<OutputFormat::Csv>("say \"hi\"\nbye")
+            == "1729240000,10.0.0.1,ascii,\"say \"\"hi\"\"\nbye\"\n");
+    REQUIRE(formatted<OutputFormat::Csv>("\x01\xff") == "1729240000,10.0.0.1,bin,01ff\n");
+}
+
+TEST_CASE("JSON lines are one line per record", "[encoder]")
+{
+    REQUIRE(formatted<OutputFormat::Json>("hello")
+            == R"({"ts":1729240000,"addr":"10.0.0.1","type":"ascii","data":"hello"})"
+                    "\n");
+    REQUIRE(formatted<OutputFormat::Json>("a\"b\\c\nd\te\x01")
+            == R"({"ts":1729240000,"addr":"10.0.0.1","type":"ascii","data":"a\"b\\c\nd\te\u0001"})"
+                    "\n");
+    REQUIRE(formatted<OutputFormat::Json>("Εδώ")
+            == R"({"ts":1729240000,"addr":"10.0.0.1","type":"utf8","data":"Εδώ"})"
+                    "\n");
+}
+
+TEST_CASE("Escaped size is exact", "[encoder]")
+{
+    const std::string data{ "no escapes here, \"but\" there are some\n\x02\\ in this one" };
+    REQUIRE(Encoder<OutputFormat::Csv>::textSize(data.data(), 15) == 15);
+    REQUIRE(Encoder<OutputFormat::Csv>::textSize(data.data(), data.size()) == data.size() + 4);
+    REQUIRE(Encoder<OutputFormat::Json>::textSize(data.data(), data.size())
+            == data.size() + 2 + 1 + 5 + 1);
+}
+
+TEST_CASE("Longest prefix that fits is exact", "[encoder]")
+{
+    const std::string data{ "plain, \"quoted\"\n\x02\\ and the rest" };
+    for (size_t limit{ 0 }; limit < 80; ++limit) {
+        const auto csv = Encoder<OutputFormat::Csv>::textPrefix(data.data(), data.size(), limit);
+        REQUIRE(Encoder<OutputFormat::Csv>::textSize(data.data(), csv) <= limit);
+        if (csv < data.size()) {
+            REQUIRE(Encoder<OutputFormat::Csv>::textSize(data.data(), csv + 1) > limit);
+        }
+        const auto json = Encoder<OutputFormat::Json>::textPrefix(data.data(), data.size(), limit);
+        REQUIRE(Encoder<OutputFormat::Json>::textSize(data.data(), json) <= limit);
+        if (json < data.size()) {
+            REQUIRE(Encoder<OutputFormat::Json>::textSize(data.data(), json + 1) > limit);
+        }
+    }
+}
+
+TEST_CASE("Payloads that grow a lot when escaped", "[encoder]")
+{
+    const std::string controls(config::buf_size, '\x01');
+    std::string escaped;
+    for (size_t i{ 0 }; i < controls.size(); ++i) escaped += "\\u0001";
+    const std::string header{ R"({"ts":1729240000,"addr":"10.0.0.1","type":"ascii","data":")" };
+
+    WHEN("there's an arena")
+    {
+        BufferArena arena(config::large_buffer_size, 2);
+        THEN("they are not cut")
+        {
+            REQUIRE(formatted<OutputFormat::Json>(controls, &arena) == header + escaped + "\"}\n");
+        }
+    }
+    WHEN("there's no arena")
+    {
+        THEN("they are cut, but still well formed")
+        {
+            const auto json = formatted<OutputFormat::Json>(controls);
+            REQUIRE(json.size() <= sizeof(FormattedData::data));
+            REQUIRE(json.starts_with(header + "\\u0001"));
+            REQUIRE(json.ends_with("\\u0001\"}\n"));
+        }
+    }
+    WHEN("only the end of it grows")
+    {
+        const std::string mixed = std::string(config::buf_size / 2, 'a')
+                + std::string(config::buf_size / 2, '\x01');
+        THEN("all the plain text and as many escapes as fit are kept")
+        {
+            const auto json = formatted<OutputFormat::Json>(mixed);
+            REQUIRE(json.size() <= sizeof(FormattedData::data));
+            // short of full by no more than the header reserve and one escape
+            REQUIRE(json.size() > sizeof(FormattedData::data) - 128 - 6);
+            REQUIRE(json.starts_with(header + std::string(config::buf_size / 2, 'a') + "\\u0001"));
+            REQUIRE(json.ends_with("\\u0001\"}\n"));
+        }
+    }
+    WHEN("it's CSV")
+    {
+        const std::string quotes(config::buf_size, '"');
+        THEN("quotes are doubled and it all fits in place")
+        {
+            REQUIRE(formatted<OutputFormat::Csv>(quotes)
+                    == "1729240000,10.0.0.1,ascii,\"" + quotes + quotes + "\"\n");
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+#include <system_error>
+#include <unistd.h>
+
+#include "BasicFormatter.hpp"
+#include "PublishingFormatter.hpp"
+#include "ShmRing.hpp"
+#include "TestUtil.hpp"
+
+using namespace mmd;
+using mmd::test::FileSizeLimit;
+
+namespace {
+std::string ringName()
+{
+    return "/mmd_shm_test_" + std::to_string(::getpid());
+}
+} // namespace
+
+TEST_CASE("Readers get records in order with their own cursors", "[shm]")
+{
+    ShmRingWriter writer(ringName(), 4096);
+    ShmRingReader first(ringName());
+    ShmRingReader second(ringName());
+
+    std::string got;
+    const auto collect = [&got](const shm::Record &rec) {
+        got += rec.data;
+    };
+
+    REQUIRE(first.read(collect) == shm::ReadResult::Empty);
+
+    // enough to wrap around the ring a few times
+    for (int i{ 0 }; i < 200; ++i) {
+        const auto text = fmt::format("{:03}", i);
+        REQUIRE(writer.publish(shm::RecordKind::Formatted, i, "10.0.0.1", text));
+        REQUIRE(first.read(collect) == shm::ReadResult::Record);
+        REQUIRE(got == text);
+        got.clear();
+    }
+    REQUIRE(first.lost() == 0);
+
+    THEN("the other reader has been overrun, and knows it")
+    {
+        REQUIRE(second.read(collect) == shm::ReadResult::Overrun);
+        REQUIRE(second.read(collect) == shm::ReadResult::Empty);
+
+        writer.publish(shm::RecordKind::Raw, 0, "10.0.0.2", "next");
+        REQUIRE(second.read(collect) == shm::ReadResult::Record);
+        REQUIRE(got == "next");
+    }
+}
+
+TEST_CASE("Reader tells how many records it missed", "[shm]")
+{
+    ShmRingWriter writer(ringName(), 4096);
+    ShmRingReader reader(ringName());
+    const auto ignore = [](const shm::Record &) {
+    };
+
+    writer.publish(shm::RecordKind::Formatted, 0, "a", "first");
+    REQUIRE(reader.read(ignore) == shm::ReadResult::Record);
+
+    for (int i{ 0 }; i < 500; ++i) {
+        writer.publish(shm::RecordKind::Formatted, 0, "a", "lots of records");
+    }
+    REQUIRE(reader.read(ignore) == shm::ReadResult::Overrun);
+
+    writer.publish(shm::RecordKind::Formatted, 0, "a", "last");
+    REQUIRE(reader.read(ignore) == shm::ReadResult::Record);
+    REQUIRE(reader.lost() == 500);
+}
+
+TEST_CASE("Publishing formatter puts records into the ring", "[shm]")
+{
+    ShmRingWriter writer(ringName(), 4096);
+    ShmRingReader reader(ringName());
+
+    BasicFormatter basic;
+    PublishingFormatter formatter(basic, writer);
+
+    char payload[] = "hello";
+    const ReceivedData rdata{ "10.0.0.1", payload, 5 };
+    const auto fdata = formatter.format(rdata);
+
+    REQUIRE(reader.read([&fdata](const shm::Record &rec) {
+        REQUIRE(rec.kind == shm::RecordKind::Formatted);
+        REQUIRE(rec.addr == "10.0.0.1");
+        REQUIRE(rec.data == fdata.view());
+    }) == shm::ReadResult::Record);
+}
+
+TEST_CASE("Publishing formatter counts records too big for the ring", "[shm]")
+{
+    // smallest ring there is, takes records up to half of it
+    ShmRingWriter writer(ringName(), 4096);
+    ShmRingReader reader(ringName());
+
+    BufferArena arena(config::jumbo_buffer_size, 2);
+    BasicFormatter basic("*", &arena);
+    PublishingFormatter formatter(basic, writer, true);
+
+    std::string payload(3000, 'x');
+    const ReceivedData rdata{ "10.0.0.1", payload.data(), payload.size(), &arena };
+    const auto unpublished = stats::unpublished.load();
+    const auto fdata = formatter.format(rdata);
+    BufferArena::release(fdata.large);
+    BufferArena::release(rdata.large);
+
+    REQUIRE(stats::unpublished.load() == unpublished + 1);
+    REQUIRE(reader.read([](const shm::Record &) {}) == shm::ReadResult::Empty);
+}
+
+TEST_CASE("Ring that can't have its memory fails right away", "[shm]")
+{
+    FileSizeLimit limit(64 * 1024);
+    REQUIRE_THROWS_AS(ShmRingWriter(ringName(), 1024 * 1024), std::system_error);
+    REQUIRE_THROWS(ShmRingReader(ringName())); // and doesn't leave its name behind
+}
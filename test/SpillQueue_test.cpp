@@ -0,0 +1,222 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "AdmissionQueue.hpp"
+#include "BufferArena.hpp"
+#include "Common.hpp"
+#include "SpillQueue.hpp"
+#include "TestUtil.hpp"
+
+using namespace mmd;
+using mmd::test::FileSizeLimit;
+
+namespace {
+std::string spillPath()
+{
+    namespace fs = std::filesystem;
+    const auto name = "mmd_spill_test_" + std::to_string(::getpid());
+    return (fs::temp_directory_path() / name).string();
+}
+
+ReceivedData numbered(int i)
+{
+    auto text = std::to_string(i);
+    return { "10.0.0.1", text.data(), text.size() };
+}
+
+int number(const ReceivedData &rdata)
+{
+    return std::stoi(std::string(rdata.payload(), rdata.datasize));
+}
+} // namespace
+
+TEST_CASE("What doesn't fit into the queue comes back in order", "[spill]")
+{
+    ReceiverQueue rqueue;
+    SpillQueue squeue(rqueue, spillPath(), 1024 * 1024);
+
+    // way past the queue capacity
+    int pushed{ 0 };
+    for (; pushed < 500; ++pushed) REQUIRE(squeue.Push(numbered(pushed)));
+    REQUIRE(squeue.spilled() >= 500 - config::queue_size);
+    REQUIRE(squeue.depth() == squeue.spilled());
+    REQUIRE(squeue.depthBytes() > 0);
+
+    // take some, push some more: these go behind the spilled ones, not into the queue
+    int popped{ 0 };
+    for (; popped < 100; ++popped) REQUIRE(number(squeue.PopOptional().value()) == popped);
+    for (; pushed < 600; ++pushed) REQUIRE(squeue.Push(numbered(pushed)));
+
+    for (; popped < 600; ++popped) {
+        const auto rdata = squeue.PopOptional();
+        REQUIRE(rdata);
+        REQUIRE(number(*rdata) == popped);
+        REQUIRE(std::string_view(rdata->addr, rdata->addrsize) == "10.0.0.1");
+    }
+    REQUIRE_FALSE(squeue.PopOptional());
+    REQUIRE(squeue.depth() == 0);
+    REQUIRE(squeue.depthBytes() == 0);
+
+    THEN("once drained, the queue is used again")
+    {
+        const auto spilled = squeue.spilled();
+        REQUIRE(squeue.Push(numbered(1)));
+        REQUIRE(squeue.spilled() == spilled);
+        REQUIRE(number(rqueue.PopOptional().value()) == 1);
+    }
+}
+
+TEST_CASE("Spill file is a ring with a limit", "[spill]")
+{
+    ReceiverQueue rqueue;
+    SpillQueue squeue(rqueue, spillPath(), 4096);
+
+    int pushed{ 0 };
+    while (squeue.Push(numbered(pushed))) pushed++;
+    REQUIRE(pushed > static_cast<int>(config::queue_size));
+    const auto spilled = squeue.spilled();
+
+    // room in the queue doesn't help while the spill file is full,
+    // room in the file does, and it goes around the end of the file a few times
+    int popped{ 0 };
+    for (int round{ 0 }; round < 1000; ++round) {
+        REQUIRE(number(squeue.PopOptional().value()) == popped++);
+        if (squeue.Push(numbered(pushed))) pushed++;
+    }
+    REQUIRE(squeue.spilled() > spilled * 5);
+    while (auto rdata = squeue.PopOptional()) REQUIRE(number(*rdata) == popped++);
+    REQUIRE(popped == pushed);
+}
+
+TEST_CASE("No spill file means just the queue", "[spill]")
+{
+    ReceiverQueue rqueue;
+    SpillQueue squeue(rqueue, spillPath(), 0);
+
+    size_t pushed{ 0 };
+    while (squeue.Push(numbered(1))) pushed++;
+    REQUIRE(pushed <= config::queue_size);
+    REQUIRE(squeue.spilled() == 0);
+}
+
+TEST_CASE("Spill file that doesn't fit on the disk fails right away", "[spill]")
+{
+    ReceiverQueue rqueue;
+    {
+        FileSizeLimit limit(64 * 1024);
+        REQUIRE_THROWS_AS(SpillQueue(rqueue, spillPath(), 1024 * 1024), std::system_error);
+    }
+
+    THEN("it's the whole size that counts, not what gets written")
+    {
+        FileSizeLimit limit(1024 * 1024);
+        SpillQueue squeue(rqueue, spillPath(), 1024 * 1024);
+        REQUIRE(squeue.Push(numbered(1)));
+    }
+}
+
+TEST_CASE("Big payloads are spilled in full", "[spill]")
+{
+    BufferArena arena(config::large_buffer_size, 2);
+    ReceiverQueue rqueue;
+    SpillQueue squeue(rqueue, spillPath(), 1024 * 1024, &arena);
+
+    while (rqueue.Push(numbered(0))) {
+    }
+
+    std::vector<char> payload(config::buf_size * 4, 'x');
+    REQUIRE(squeue.Push({ "10.0.0.1", payload.data(), payload.size(), &arena }));
+    REQUIRE(squeue.spilledBytes() == payload.size());
+
+    auto rdata = squeue.PopOptional();
+    while (rdata && !rdata->large) rdata = squeue.PopOptional();
+    REQUIRE(rdata);
+    REQUIRE(rdata->large);
+    REQUIRE(std::string_view(rdata->payload(), rdata->datasize)
+            == std::string(payload.size(), 'x'));
+    BufferArena::release(rdata->large);
+
+    THEN("the arena got its buffer back when the payload was spilled")
+    {
+        REQUIRE(arena.acquire());
+        REQUIRE(arena.acquire());
+    }
+}
+
+TEST_CASE("Order holds with producer and consumer in their own threads", "[spill]")
+{
+    ReceiverQueue rqueue;
+    SpillQueue squeue(rqueue, spillPath(), 64 * 1024);
+    static constexpr int count{ 100000 };
+
+    auto producer = std::thread([&squeue] {
+        for (int i{ 0 }; i < count;) {
+            if (squeue.Push(numbered(i))) i++;
+        }
+    });
+
+    int expected{ 0 };
+    bool in_order{ true };
+    while (expected < count) {
+        if (const auto rdata = squeue.PopOptional(); rdata) {
+            in_order = in_order && number(*rdata) == expected;
+            expected++;
+        }
+    }
+    producer.join();
+    REQUIRE(in_order);
+}
+
+TEST_CASE("Admission summary reports the spill depth", "[spill]")
+{
+    ReceiverQueue rqueue;
+    SpillQueue squeue(rqueue, spillPath(), 1024 * 1024);
+    AdmissionQueue aqueue(squeue, { 0, 0, 0, 0 });
+
+    while (rqueue.Push(numbered(0))) {
+    }
+    REQUIRE(aqueue.Push(numbered(0)));
+    REQUIRE(squeue.depth() == 1);
+
+    // the summary goes behind the one spilled record
+    REQUIRE(aqueue.Push(numbered(0)));
+    std::optional<ReceivedData> summary;
+    while (auto rdata = aqueue.PopOptional()) {
+        if (std::string_view(rdata->addr, rdata->addrsize) == "mmdsrv") summary = rdata;
+    }
+    REQUIRE(summary);
+    REQUIRE(std::string_view(summary->data, summary->datasize)
+                    .ends_with(";spill;1;spillbytes;48"));
+}
+
+TEST_CASE("Spilled records don't count as a full queue when sampling", "[spill]")
+{
+    ReceiverQueue rqueue;
+    SpillQueue squeue(rqueue, spillPath(), 8192);
+    AdmissionQueue aqueue(squeue, { 0, 0, 4, 0 });
+
+    while (squeue.spilled() < 20) REQUIRE(squeue.Push(numbered(0)));
+    const auto in_queue = squeue.queued();
+    REQUIRE(aqueue.samplingStep() == 16);
+
+    // the queue goes first, what's left is in the file, and there's plenty of room there
+    for (uint64_t i{ 0 }; i < in_queue; ++i) REQUIRE(aqueue.PopOptional());
+    REQUIRE(aqueue.occupancy() == 0);
+    REQUIRE(squeue.depth() == 20);
+    REQUIRE(aqueue.samplingStep() == 1);
+
+    THEN("a spill file that fills up is sampled the same way as the queue")
+    {
+        while (squeue.depthBytes() * 2 < squeue.capacityBytes()) squeue.Push(numbered(0));
+        REQUIRE(aqueue.samplingStep() == 4);
+        while (squeue.depthBytes() * 4 < squeue.capacityBytes() * 3) squeue.Push(numbered(0));
+        REQUIRE(aqueue.samplingStep() == 16);
+    }
+}
@@ -0,0 +1,43 @@
+/**
+ * @file TestUtil.hpp
+ * @brief Helpers shared by more than one test
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef TESTUTIL_HPP_
+#define TESTUTIL_HPP_
+
+#include <csignal>
+#include <sys/resource.h>
+
+namespace mmd::test {
+
+/**
+ * @brief Caps the size of files this process may make, the next best thing to a full disk
+ */
+struct FileSizeLimit
+{
+    FileSizeLimit(rlim_t limit)
+    {
+        ::getrlimit(RLIMIT_FSIZE, &saved);
+        const rlimit lowered{ limit, saved.rlim_max };
+        ::setrlimit(RLIMIT_FSIZE, &lowered);
+        handler = std::signal(SIGXFSZ, SIG_IGN);
+    }
+
+    ~FileSizeLimit()
+    {
+        ::setrlimit(RLIMIT_FSIZE, &saved);
+        std::signal(SIGXFSZ, handler);
+    }
+
+    rlimit saved{};
+    void (*handler)(int);
+};
+
+} // namespace mmd::test
+
+#endif // TESTUTIL_HPP_
@@ -0,0 +1,108 @@
+#include <fmt/core.h>
+
+#include <cstdio>
+#include <cxxopts.hpp>
+#include <exception>
+#include <limits>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "Common.hpp"
+#include "LogIndex.hpp"
+#include "LogRecord.hpp"
+#include "MappedFile.hpp"
+
+/**
+ * @brief Prints records of the chunk that match the query, returns how many did
+ */
+size_t printMatching(std::string_view chunk, mmd::OutputFormat format, size_t from, size_t to,
+                     const std::optional<std::string> &address)
+{
+    size_t matched{ 0 };
+    mmd::RecordCursor cursor(chunk, format);
+    while (const auto rec = cursor.next()) {
+        const auto parsed = mmd::parseRecord(*rec, format);
+        if (!parsed) continue;
+        if (parsed->timestamp < from || parsed->timestamp > to) continue;
+        if (address && parsed->addr != *address) continue;
+        std::fwrite(rec->data(), 1, rec->size(), stdout);
+        std::fputc('\n', stdout);
+        matched++;
+    }
+    return matched;
+}
+
+int main(int argc, char **argv)
+try {
+    cxxopts::Options options("mmdquery", "Finds records in mmdsrv log using its index");
+
+    // clang-format off
+    options.add_options()
+    ("h,help",    "Print usage")
+    ("i,input",   "Set log file name", cxxopts::value<std::string>()->default_value("./mmdsrv.log"))
+    ("a,address", "Only records from this sender", cxxopts::value<std::string>())
+    ("f,from",    "Only records at or after this unix time", cxxopts::value<size_t>()->default_value("0"))
+    ("t,to",      "Only records at or before this unix time", cxxopts::value<size_t>()->default_value(std::to_string(std::numeric_limits<size_t>::max())));
+    // clang-format on
+
+    const auto params = options.parse(argc, argv);
+    if (params.count("help")) {
+        fmt::print("{}\n", options.help());
+        return 0;
+    }
+
+    const auto filename = params["input"].as<std::string>();
+    const auto from = params["from"].as<size_t>();
+    const auto to = params["to"].as<size_t>();
+    const auto address = params.count("address")
+            ? std::optional{ params["address"].as<std::string>() }
+            : std::nullopt;
+    const auto key = address ? mmd::sourceKey(*address) : 0;
+
+    mmd::MappedFile log(filename);
+    const auto data = log.view();
+
+    // without an index the whole log is the unindexed tail
+    std::optional<mmd::IndexReader> index;
+    try {
+        index.emplace(filename);
+    } catch (const std::exception &e) {
+        fmt::print(stderr, "No usable index ({}), scanning the whole log\n", e.what());
+    }
+    const auto format = index ? index->format() : mmd::index::guessFormat(data);
+    const auto blocks = index ? index->blocks() : std::span<const mmd::index::Block>{};
+    const auto indexed = index ? index->indexedSize() : 0;
+
+    size_t matched{ 0 };
+    size_t scanned{ 0 };
+    for (const auto &block : blocks) {
+        if (block.ts_max < from || block.ts_min > to) continue;
+        if (address && !mmd::index::bloomMayContain(block, key)) continue;
+        if (block.offset + block.size > data.size()) break; // log was truncated under us
+        matched += printMatching(data.substr(block.offset, block.size), format, from, to,
+                                 address);
+        scanned += block.size;
+    }
+
+    // whatever the writer didn't get to index yet
+    if (indexed < data.size()) {
+        const auto tail = data.substr(indexed);
+        matched += printMatching(tail, format, from, to, address);
+        scanned += tail.size();
+    }
+
+    fmt::print(stderr, "{} records matched, {} of {} bytes scanned\n", matched, scanned,
+               data.size());
+} catch (const cxxopts::exceptions::exception &e) {
+    fmt::print(stderr, "Error parsing command line args. Try --help for usage details.");
+    return 1;
+} catch (const std::runtime_error &e) {
+    fmt::print(stderr, "Failed with exception: {}", e.what());
+    return 2;
+} catch (...) {
+    fmt::print(stderr, "Failed with unknown exception");
+    return 3;
+}
@@ -0,0 +1,250 @@
+#include <fmt/core.h>
+
+#include <asio/ts/internet.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cxxopts.hpp>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "Common.hpp"
+#include "LogIndex.hpp"
+#include "LogRecord.hpp"
+#include "MappedFile.hpp"
+
+using asio::ip::udp;
+
+namespace {
+
+/**
+ * @brief Collects datagrams and sends them with one sendmmsg call
+ * Text payloads are sent straight from the mapped log, only binary ones,
+ * and text with CSV or JSON escapes in it, are decoded into the scratch buffer.
+ */
+class Batch
+{
+public:
+    static constexpr size_t capacity{ 64 };
+
+    Batch(int fd)
+        : _fd{ fd }
+        , _scratch(capacity * mmd::config::max_datagram_size)
+        , _unescaped(mmd::config::max_datagram_size * 6)
+    {
+    }
+
+    /**
+     * @brief Adds the payload of the record, sends the batch if it gets full
+     * @return false if the record couldn't be decoded
+     */
+    bool add(const mmd::LogRecord &rec)
+    {
+        if (_count == capacity) flush();
+
+        auto &iov = _iov[_count];
+        auto *out = _scratch.data() + _count * mmd::config::max_datagram_size;
+        if (rec.type == "bin") {
+            const auto hex = rec.data.substr(0, mmd::config::max_datagram_size * 2);
+            const auto size = mmd::decodeHex(hex, out);
+            if (!size) return false;
+            iov = { out, *size };
+        } else if (rec.escaped) {
+            // escapes only ever make it longer, so anything bigger isn't one of ours
+            if (rec.data.size() > mmd::config::max_datagram_size * 6) return false;
+            const auto size = mmd::unescapeData(rec, _unescaped.data());
+            if (!size || *size > mmd::config::max_datagram_size) return false;
+            std::copy_n(_unescaped.data(), *size, out);
+            iov = { out, *size };
+        } else {
+            iov = { const_cast<char *>(rec.data.data()), rec.data.size() };
+        }
+        _msgs[_count] = {};
+        _msgs[_count].msg_hdr.msg_iov = &iov;
+        _msgs[_count].msg_hdr.msg_iovlen = 1;
+        _bytes += iov.iov_len;
+        _count++;
+        return true;
+    }
+
+    void flush()
+    {
+        size_t done{ 0 };
+        while (done < _count) {
+            const auto sent = ::sendmmsg(_fd, &_msgs[done], _count - done, 0);
+            if (sent == -1) {
+                // an ICMP error for an earlier datagram, this one wasn't sent yet, so again
+                if (errno == ECONNREFUSED) {
+                    _refused++;
+                    continue;
+                }
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::generic_category(), "Failed to send");
+            }
+            done += sent;
+            _sent += sent;
+        }
+        _count = 0;
+    }
+
+    [[nodiscard]] size_t sent() const
+    {
+        return _sent;
+    }
+    [[nodiscard]] size_t refused() const
+    {
+        return _refused;
+    }
+    [[nodiscard]] size_t bytes() const
+    {
+        return _bytes;
+    }
+
+private:
+    int _fd;
+    std::vector<char> _scratch;
+    std::vector<char> _unescaped; // escaped data may be longer than a scratch slot
+    std::array<iovec, capacity> _iov{};
+    std::array<mmsghdr, capacity> _msgs{};
+    size_t _count{ 0 };
+    size_t _sent{ 0 };
+    size_t _refused{ 0 };
+    size_t _bytes{ 0 };
+};
+
+using clock = std::chrono::steady_clock;
+
+// records due sooner than this are sent early with the batch, not worth a syscall and a sleep
+constexpr auto flush_ahead = std::chrono::milliseconds(1);
+
+/**
+ * @brief Converts seconds of the log into time of the replay
+ */
+clock::duration replayTime(double seconds, double speed)
+{
+    return std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(seconds / speed));
+}
+
+/**
+ * @brief Sends records that were logged within the same second
+ * The log only has whole seconds, so they are spread evenly over the second
+ * rather than sent in one burst at its start. Records due within flush_ahead
+ * still go out together, so high speeds keep batching.
+ * @param start When the second begins
+ * @param length How long the second lasts at the replay speed, 0 to send at once
+ * @return Number of records that couldn't be decoded
+ */
+size_t sendSecond(Batch &batch, const std::vector<mmd::LogRecord> &records,
+                  clock::time_point start, clock::duration length)
+{
+    size_t skipped{ 0 };
+    for (size_t i{ 0 }; i < records.size(); ++i) {
+        if (length.count() > 0) {
+            const auto due = start + length * i / records.size();
+            if (due - clock::now() > flush_ahead) {
+                batch.flush();
+                std::this_thread::sleep_until(due);
+            }
+        }
+        if (!batch.add(records[i])) skipped++;
+    }
+    return skipped;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+try {
+    cxxopts::Options options("mmdreplay", "Sends records of mmdsrv log to a UDP port again");
+
+    // clang-format off
+    options.add_options()
+    ("h,help",    "Print usage")
+    ("i,input",   "Set log file name", cxxopts::value<std::string>()->default_value("./mmdsrv.log"))
+    ("t,target",  "Set target address, IPv4 or IPv6", cxxopts::value<std::string>()->default_value("127.0.0.1"))
+    ("p,port",    "Set target port", cxxopts::value<uint16_t>()->default_value("7768"))
+    ("s,speed",   "Speed relative to the original timing, 0 for as fast as possible", cxxopts::value<double>()->default_value("1"))
+    ("a,address", "Only replay records from this sender", cxxopts::value<std::string>());
+    // clang-format on
+
+    const auto params = options.parse(argc, argv);
+    if (params.count("help")) {
+        fmt::print("{}\n", options.help());
+        return 0;
+    }
+
+    const auto filename = params["input"].as<std::string>();
+    const auto speed = params["speed"].as<double>();
+    if (!std::isfinite(speed) || speed < 0) {
+        throw std::runtime_error("Speed must be a finite number, 0 or more");
+    }
+    const auto address = params.count("address")
+            ? std::optional{ params["address"].as<std::string>() }
+            : std::nullopt;
+
+    asio::io_context context;
+    udp::socket socket(context);
+    socket.connect(
+            udp::endpoint(asio::ip::make_address(params["target"].as<std::string>()),
+                          params["port"].as<uint16_t>()));
+
+    mmd::MappedFile log(filename);
+    const auto format = mmd::logFormat(filename, log.view());
+    Batch batch(socket.native_handle());
+
+    const auto started = clock::now();
+    std::optional<size_t> first_ts;
+    size_t skipped{ 0 };
+
+    // records of the second being read, they go out once the next second starts
+    std::vector<mmd::LogRecord> second;
+    const auto send = [&] {
+        if (second.empty()) return;
+        auto start = started;
+        clock::duration length{};
+        if (speed > 0) {
+            start += replayTime(static_cast<double>(second.front().timestamp)
+                                        - static_cast<double>(*first_ts),
+                                speed);
+            length = replayTime(1, speed);
+        }
+        skipped += sendSecond(batch, second, start, length);
+        second.clear();
+    };
+
+    mmd::RecordCursor cursor(log.view(), format);
+    while (const auto rec = cursor.next()) {
+        const auto parsed = mmd::parseRecord(*rec, format);
+        // our own shedding summaries are not something a device sent
+        if (!parsed || parsed->addr == "mmdsrv" || (address && parsed->addr != *address)) {
+            skipped++;
+            continue;
+        }
+
+        if (!first_ts) first_ts = parsed->timestamp;
+        if (!second.empty() && second.front().timestamp != parsed->timestamp) send();
+        second.push_back(*parsed);
+    }
+    send();
+    batch.flush();
+
+    const auto elapsed = std::chrono::duration<double>(clock::now() - started).count();
+    fmt::print(stderr, "{} datagrams ({} bytes) sent in {:.3f}s, {} refused, {} records skipped\n",
+               batch.sent(), batch.bytes(), elapsed, batch.refused(), skipped);
+} catch (const cxxopts::exceptions::exception &e) {
+    fmt::print(stderr, "Error parsing command line args. Try --help for usage details.");
+    return 1;
+} catch (const std::runtime_error &e) {
+    fmt::print(stderr, "Failed with exception: {}", e.what());
+    return 2;
+} catch (...) {
+    fmt::print(stderr, "Failed with unknown exception");
+    return 3;
+}
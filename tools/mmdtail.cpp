@@ -0,0 +1,78 @@
+#include <fmt/format.h>
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cxxopts.hpp>
+#include <iterator>
+#include <string>
+#include <thread>
+
+#include "ShmRing.hpp"
+
+namespace {
+volatile std::sig_atomic_t stop_requested{ 0 };
+}
+
+int main(int argc, char **argv)
+try {
+    cxxopts::Options options("mmdtail", "Prints records published by mmdsrv to shared memory");
+
+    // clang-format off
+    options.add_options()
+    ("h,help",  "Print usage")
+    ("shm",     "Set shared memory ring name", cxxopts::value<std::string>()->default_value("/mmdsrv"))
+    ("n,count", "Stop after this many records, 0 for never", cxxopts::value<size_t>()->default_value("0"));
+    // clang-format on
+
+    const auto params = options.parse(argc, argv);
+    if (params.count("help")) {
+        fmt::print("{}\n", options.help());
+        return 0;
+    }
+    const auto count = params["count"].as<size_t>();
+
+    std::signal(SIGINT, [](int) { stop_requested = 1; });
+    mmd::ShmRingReader reader(params["shm"].as<std::string>());
+
+    size_t printed{ 0 };
+    size_t overruns{ 0 };
+    // the record may be overwritten while we look at it, so it's copied and only printed
+    // once read() says the copy is good
+    std::string line;
+    while (!stop_requested && (count == 0 || printed < count)) {
+        const auto result = reader.read([&line](const mmd::shm::Record &rec) {
+            line.clear();
+            if (rec.kind == mmd::shm::RecordKind::Raw) {
+                fmt::format_to(std::back_inserter(line), "{};{};", rec.timestamp, rec.addr);
+            }
+            line += rec.data;
+            if (!rec.data.ends_with('\n')) line += '\n';
+        });
+        switch (result) {
+        case mmd::shm::ReadResult::Record:
+            std::fwrite(line.data(), 1, line.size(), stdout);
+            printed++;
+            break;
+        case mmd::shm::ReadResult::Overrun:
+            overruns++;
+            fmt::print(stderr, "overrun, skipping to the newest record\n");
+            break;
+        case mmd::shm::ReadResult::Empty:
+            // nothing to do, don't burn the CPU either
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            break;
+        }
+    }
+
+    fmt::print(stderr, "{} records, {} lost, {} overruns\n", printed, reader.lost(), overruns);
+} catch (const cxxopts::exceptions::exception &e) {
+    fmt::print(stderr, "Error parsing command line args. Try --help for usage details.");
+    return 1;
+} catch (const std::runtime_error &e) {
+    fmt::print(stderr, "Failed with exception: {}", e.what());
+    return 2;
+} catch (...) {
+    fmt::print(stderr, "Failed with unknown exception");
+    return 3;
+}